@@ -0,0 +1,631 @@
+/*
+ * HashMap, ConcurrentHashMap and MappedHashMap of Task3.1.2.cpp
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Snapshot.h"
+#include "Vector.h"
+
+using namespace std;
+
+template<typename T>
+class MyIterator : public iterator<input_iterator_tag, T> {
+    T *p;
+    const int *c;  // Control word of *p
+    T *next_p;  // Slots iterated after the sentinel of this array, if any
+    const int *next_c;
+
+    void skip() {
+        while (true) {
+            while (*c == -1) {  // Skipping empty slots, the control after the last slot is -2
+                ++p;
+                ++c;
+            }
+            if (*c != -2 || !next_p) return;
+            p = next_p;
+            c = next_c;
+            next_p = nullptr;
+        }
+    }
+
+public:
+    MyIterator(T *p, const int *c, T *next_p = nullptr, const int *next_c = nullptr)
+            : p(p), c(c), next_p(next_p), next_c(next_c) { skip(); }
+
+    MyIterator(const MyIterator &it) : p(it.p), c(it.c), next_p(it.next_p), next_c(it.next_c) {}
+
+    bool operator!=(MyIterator const &other) const { return p != other.p; }
+
+    bool operator==(MyIterator const &other) const { return p == other.p; }
+
+    typename MyIterator::reference operator*() const { return *p; }
+
+    MyIterator &operator++() {
+        ++p;
+        ++c;
+        skip();
+        return *this;
+    }
+};
+
+
+inline size_t mix(size_t h) {  // Spreads every bit of h over the high and the low bits
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 33);
+}
+
+
+template<typename K, typename Q>
+size_t key_hash(const Q &key) {  // Mixed hash<K> of a key given as anything K compares with, a string as string_view
+    if constexpr (is_same_v<K, string>) return mix(hash<string_view>{}(string_view(key)));
+    else return mix(hash<K>{}(key));
+}
+
+
+class HyperLogLog {  // Distinct count estimate in 4 KB, the standard error is 1.04 / sqrt(4096) = 1.6%
+    static const int bits = 12;
+    static const int registers = 1 << bits;
+
+    unsigned char reg[registers] = {};
+
+public:
+    void add(size_t h) {  // h must be mixed
+        size_t rest = h << bits | size_t(1) << (bits - 1);  // The guard bit bounds the rank
+        unsigned char rank = __builtin_clzll(rest) + 1;
+        unsigned char &r = reg[h >> (64 - bits)];
+        if (rank > r) r = rank;
+    }
+
+    [[nodiscard]] double estimate() const {
+        double sum = 0;
+        int zeros = 0;
+        for (unsigned char r: reg) {
+            sum += 1.0 / double(1ULL << r);
+            zeros += r == 0;
+        }
+        double e = 0.7213 / (1 + 1.079 / registers) * registers * registers / sum;
+        if (e <= 2.5 * registers && zeros) e = registers * log(double(registers) / zeros);  // Linear counting
+        return e;
+    }
+};
+
+
+// Header, slots, text. Written and read by the same build, the hashes are not portable
+struct HashMapSnapshotHeader {
+    char magic[8];
+    uint64_t slots;  // A power of two, at least twice the size
+    uint64_t size;
+    uint64_t slot_size;  // A snapshot of other types is refused
+};
+
+inline constexpr char hash_map_snapshot_magic[8] = "HMSNAP1";
+
+template<typename K, typename V>
+struct HashMapSnapshotSlot {  // Linear probing from hash & (slots - 1)
+    uint64_t hash;  // hash | 1, 0 is a free slot
+    Stored<K> key;
+    Stored<V> value;
+};
+
+
+
+// exact_unique keeps a count of every value, so that getUnique() is O(1). Without it getUnique() is a HyperLogLog
+// estimate over one pass, for maps whose values do not fit in memory twice
+template<typename K, typename V, bool exact_unique = true>
+class HashMap {
+    static const int default_size = 16;
+    static const int migrate_step = 16;  // Old slots moved by every add and remove during a rehash
+
+    // A full slot keeps its distance from the home slot and 7 bits of the hash of its key as dist << 7 | h2
+    static const int empty = -1;
+    static const int sentinel = -2;
+
+    struct Node {
+        K key;
+        V value;
+        size_t hash;  // Growth moves nodes without hashing the keys again
+    };
+
+    // Robin Hood linear probing: a key never passes a slot whose node is closer to its own home. A probe stops at
+    // the first such slot, and removal shifts the rest of the run back instead of leaving a tombstone
+    struct Table {
+        Node *arr = nullptr;  // Raw storage, a Node is constructed only in a full slot
+        int *ctrl = nullptr;  // memory + 1 words, ctrl[memory] == sentinel
+        int memory = 0;  // Power of two, 0 if there is no table
+
+        [[nodiscard]] int home(size_t h) const { return int((h >> 7) & (memory - 1)); }
+
+        [[nodiscard]] int next(int i) const { return (i + 1) & (memory - 1); }
+
+        // Index of the key or -1. A missing key would be placed at *stop with control *stop_c
+        template<typename Q>
+        int find(const Q &key, size_t h, int *stop = nullptr, int *stop_c = nullptr) const {
+            int i = home(h), c = h2(h);  // c is the control the key would have in slot i
+            for (; ctrl[i] >= (c & ~0x7F); c += 0x80, i = next(i))
+                if (ctrl[i] == c && arr[i].hash == h && arr[i].key == key) return i;
+            if (stop) {
+                *stop = i;
+                *stop_c = c;
+            }
+            return -1;
+        }
+
+        int place(size_t h) {  // Frees a slot for a new key
+            int i = home(h), c = h2(h);
+            for (; ctrl[i] >= (c & ~0x7F); c += 0x80)
+                i = next(i);
+            return place(i, c);
+        }
+
+        int place(int i, int c) {  // Shifts the run from slot i forward, its nodes are closer to home than c
+            int e = i;
+            while (ctrl[e] != empty)
+                e = next(e);
+            for (; e != i; e = (e - 1) & (memory - 1)) {
+                int from = (e - 1) & (memory - 1);
+                new(&arr[e]) Node(std::move(arr[from]));
+                arr[from].~Node();
+                ctrl[e] = ctrl[from] + 0x80;
+            }
+            ctrl[i] = c;
+            return i;
+        }
+
+        void erase(int i) {  // Destroys the node and shifts back the nodes after it that are not at home
+            arr[i].~Node();
+            for (int j = next(i); ctrl[j] >= 0x80; i = j, j = next(j)) {
+                new(&arr[i]) Node(std::move(arr[j]));
+                arr[j].~Node();
+                ctrl[i] = ctrl[j] - 0x80;
+            }
+            ctrl[i] = empty;
+        }
+    };
+
+    Table table;  // Every new key goes here
+    Table old;  // Table being moved into table, memory == 0 when no rehash is in progress
+    int migrated;  // Slots of old before it are empty
+    int old_size;  // Keys still in old
+    int active_size;  // Keys in both tables
+    int general_size;  // Keys in table
+    double max_load;
+
+    struct NoCounts {
+    };
+    conditional_t<exact_unique, HashMap<V, int, false>, NoCounts> counts;  // Number of keys with each value
+
+    template<typename, typename, bool> friend
+    class HashMap;
+
+    template<typename Q>
+    Node *locate(const Q &key) const {
+        size_t h = hashOf(key);
+        int i = table.find(key, h);
+        if (i != -1) return &table.arr[i];
+        if (old.memory && (i = old.find(key, h)) != -1) return &old.arr[i];
+        return nullptr;
+    }
+
+    void count(const V &value, int d) {
+        if constexpr (exact_unique) {
+            auto *node = counts.locate(value);
+            if (!node) counts.add(value, d);
+            else if ((node->value += d) == 0) counts.remove(value);
+        }
+    }
+
+    template<typename Q>
+    static size_t hashOf(const Q &key) { return key_hash<K>(key); }
+
+    static int h2(size_t h) { return int(h & 0x7F); }
+
+    static Table allocate(int n) {
+        Table t;
+        t.memory = n;
+        t.arr = static_cast<Node *>(::operator new(sizeof(Node) * n));
+        t.ctrl = new int[n + 1];
+        for (int i = 0; i < n; ++i)
+            t.ctrl[i] = empty;
+        t.ctrl[n] = sentinel;
+        return t;
+    }
+
+    static void release(Table &t) {
+        for (int i = 0; i < t.memory; ++i)
+            if (t.ctrl[i] >= 0)
+                t.arr[i].~Node();
+        ::operator delete(t.arr);
+        delete[] t.ctrl;
+        t = Table{};
+    }
+
+    void migrate(int slots) {  // Moves the nodes of the next slots of old into table
+        for (; slots > 0 && migrated < old.memory; --slots) {
+            if (old.ctrl[migrated] == empty) {
+                ++migrated;
+                continue;
+            }
+            Node &node = old.arr[migrated];
+            new(&table.arr[table.place(node.hash)]) Node(std::move(node));
+            old.erase(migrated);  // The next node of the run may shift into this slot
+            ++general_size;
+            --old_size;
+        }
+        if (old.memory && migrated == old.memory) {  // Every node is moved, nothing to destroy
+            ::operator delete(old.arr);
+            delete[] old.ctrl;
+            old = Table{};
+        }
+    }
+
+    template<typename Q>
+    bool add(const Q &key, const V &value, size_t h) {
+        migrate(migrate_step);
+        int stop = -1, stop_c = 0;
+        int i = table.find(key, h, &stop, &stop_c);
+        Node *existing = i != -1 ? &table.arr[i] : nullptr;
+        if (!existing && old.memory && (i = old.find(key, h)) != -1) existing = &old.arr[i];
+        if (existing) {
+            if (existing->value == value) return false;
+            count(existing->value, -1);
+            count(value, 1);
+            existing->value = value;
+            return true;
+        }
+        if (general_size + old_size + 1 > max_load * table.memory) {
+            rehash(table.memory * 2);
+            stop = -1;
+        }
+        new(&table.arr[stop == -1 ? table.place(h) : table.place(stop, stop_c)]) Node{K(key), value, h};
+        count(value, 1);
+        ++general_size;
+        ++active_size;
+        return true;
+    }
+
+    template<typename Q>
+    bool remove(const Q &key, size_t h) {
+        migrate(migrate_step);
+        int i = table.find(key, h);
+        if (i != -1) {
+            count(table.arr[i].value, -1);
+            table.erase(i);
+            --general_size;
+        } else if (old.memory && (i = old.find(key, h)) != -1) {
+            count(old.arr[i].value, -1);
+            old.erase(i);
+            --old_size;
+        } else {
+            return false;
+        }
+        --active_size;
+        return true;
+    }
+
+    void rehash(int n) {  // Starts moving every key into a new table of n slots
+        migrate(old.memory);
+        old = table;
+        migrated = 0;
+        old_size = active_size;
+        table = allocate(n);
+        general_size = 0;
+    }
+
+public:
+    // max_load is clamped to [0.25, 0.95]: a table filled to 1 has no free slot to end a probe, and near 0 every add
+    // would grow it
+    explicit HashMap(double max_load = 0.875) : migrated(0), old_size(0), active_size(0), general_size(0),
+                                                max_load(max_load >= 0.25 ? min(max_load, 0.95) : 0.25) {
+        table = allocate(default_size);
+    }
+
+    HashMap(const HashMap &) = delete;
+
+    HashMap &operator=(const HashMap &) = delete;
+
+    ~HashMap() {
+        release(table);
+        release(old);
+    }
+
+    void reserve(int n) {  // Makes room for n keys at once, so adding them does not rehash
+        int memory = default_size;
+        while (n > max_load * memory) memory *= 2;
+        if (memory <= table.memory) return;
+        rehash(memory);
+        migrate(old.memory);
+    }
+
+    // The key may be anything K compares with, such as a string_view, it is converted to K only when inserted
+    template<typename Q>
+    bool add(const Q &key, const V &value) { return add(key, value, hashOf(key)); }
+
+    template<typename Q>
+    bool remove(const Q &key) { return remove(key, hashOf(key)); }
+
+    // Applies the operations in order, op.remove ? remove(op.key) : add(op.key, V(op.value)). The hashes of a
+    // block are computed and its home slots prefetched first, so the cache misses of the block overlap
+    template<typename Op>
+    void apply(const Op *ops, int n) {
+        const int block = 16;
+        size_t h[block];
+        for (int start = 0; start < n; start += block) {
+            int count = min(block, n - start);
+            for (int i = 0; i < count; ++i) {
+                h[i] = hashOf(ops[start + i].key);
+                int home = table.home(h[i]);
+                __builtin_prefetch(&table.ctrl[home]);
+                __builtin_prefetch(&table.arr[home]);
+            }
+            for (int i = 0; i < count; ++i) {
+                const Op &op = ops[start + i];
+                if (op.remove) remove(op.key, h[i]);
+                else add(op.key, V(op.value), h[i]);
+            }
+        }
+    }
+
+    template<typename Q>
+    [[nodiscard]] bool contains(const Q &key) const { return locate(key) != nullptr; }
+
+    template<typename Q>
+    [[nodiscard]] const Node *lookup(const Q &key) const { return locate(key); }
+
+    // The value in place or nullptr, valid until the next add or remove. Read-only, so the value counts stay right
+    template<typename Q>
+    const V *find(const Q &key) const {
+        const Node *node = locate(key);
+        return node ? &node->value : nullptr;
+    }
+
+    template<typename Q>
+    V operator[](const Q &key) const {  // A copy of the value or V{}
+        const V *value = find(key);
+        return value ? *value : V{};
+    }
+
+    void print() {
+        for (const Node &it: *this) {
+            cout << it.key << ' ' << it.value << endl;
+        }
+    }
+
+    [[nodiscard]] int getSize() const { return active_size; }
+
+    [[nodiscard]] Vector<int> probeHistogram() const {  // [d] is the number of keys d slots after their home
+        Vector<int> histogram;
+        for (const Table *t: {&table, &old}) {
+            for (int i = 0; i < t->memory; ++i) {
+                if (t->ctrl[i] == empty) continue;
+                while (t->ctrl[i] >> 7 >= histogram.getSize())
+                    histogram.add(0);
+                ++histogram[t->ctrl[i] >> 7];
+            }
+        }
+        return histogram;
+    }
+
+    [[nodiscard]] int getUnique() const {
+        if constexpr (exact_unique) {
+            return counts.getSize();
+        } else {
+            HyperLogLog sketch;
+            for (const Node &it: *this)
+                sketch.add(mix(hash<V>{}(it.value)));
+            return int(sketch.estimate() + 0.5);
+        }
+    }
+
+    [[nodiscard]] size_t bytes() const {
+        size_t b = size_t(table.memory + old.memory) * (sizeof(Node) + sizeof(int)) + (old.memory ? 2 : 1) * sizeof(int);
+        if constexpr (exact_unique) b += counts.bytes();
+        return b;
+    }
+
+    bool save(const string &path) const {  // Writes a snapshot for MappedHashMap, false if it could not
+        using Slot = HashMapSnapshotSlot<K, V>;
+        int slots = 2;
+        while (slots < 2 * active_size) slots *= 2;
+        Vector<Slot> arr(slots, Slot{});
+        string text;
+        for (const Node &node: *this) {
+            uint64_t h = node.hash | 1;
+            int i = int(h & (slots - 1));
+            while (arr[i].hash) i = (i + 1) & (slots - 1);
+            arr[i] = {h, Stored<K>::put(node.key, text), Stored<V>::put(node.value, text)};
+        }
+        HashMapSnapshotHeader header{{}, uint64_t(slots), uint64_t(active_size), sizeof(Slot)};
+        memcpy(header.magic, hash_map_snapshot_magic, sizeof(hash_map_snapshot_magic));
+        ofstream out(path, ios::binary);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(&arr[0]), streamsize(slots) * sizeof(Slot));
+        out.write(text.data(), streamsize(text.size()));
+        return bool(out);
+    }
+
+    // During a rehash the keys of table are followed by the keys still in old
+    MyIterator<Node> begin() { return MyIterator<Node>(table.arr, table.ctrl, old.arr, old.ctrl); }
+
+    MyIterator<Node> end() {
+        const Table &last = old.memory ? old : table;
+        return MyIterator<Node>(&last.arr[last.memory], &last.ctrl[last.memory]);
+    }
+
+    [[nodiscard]] MyIterator<const Node> begin() const {
+        return MyIterator<const Node>(table.arr, table.ctrl, old.arr, old.ctrl);
+    }
+
+    [[nodiscard]] MyIterator<const Node> end() const {
+        const Table &last = old.memory ? old : table;
+        return MyIterator<const Node>(&last.arr[last.memory], &last.ctrl[last.memory]);
+    }
+};
+
+
+// HashMap split into 2^shard_bits independently locked and resized shards, chosen by the high hash bits. Readers
+// of a shard share its lock, so only writers to the same shard wait for each other
+template<typename K, typename V, int shard_bits = 6>
+class ConcurrentHashMap {
+    static const int shard_count = 1 << shard_bits;
+
+    // Each shard starts on its own cache line, so that its lock does not share a line with the end of the previous
+    // shard. Without getUnique() here, the shards skip the exact count of values
+    struct alignas(64) Shard {
+        mutable shared_mutex mutex;
+        HashMap<K, V, false> map;
+    };
+
+    Shard shards[shard_count];
+
+    template<typename Q>
+    Shard &shardOf(const Q &key) { return shards[key_hash<K>(key) >> (64 - shard_bits)]; }
+
+    template<typename Q>
+    const Shard &shardOf(const Q &key) const { return shards[key_hash<K>(key) >> (64 - shard_bits)]; }
+
+public:
+    template<typename Q>
+    bool add(const Q &key, const V &value) {
+        Shard &shard = shardOf(key);
+        unique_lock lock(shard.mutex);
+        return shard.map.add(key, value);
+    }
+
+    template<typename Q>
+    bool remove(const Q &key) {
+        Shard &shard = shardOf(key);
+        unique_lock lock(shard.mutex);
+        return shard.map.remove(key);
+    }
+
+    template<typename Q>
+    [[nodiscard]] bool contains(const Q &key) const {
+        const Shard &shard = shardOf(key);
+        shared_lock lock(shard.mutex);
+        return shard.map.contains(key);
+    }
+
+    template<typename Q>
+    V operator[](const Q &key) const {  // A copy taken under the lock, the node may move once it is released
+        const Shard &shard = shardOf(key);
+        shared_lock lock(shard.mutex);
+        return shard.map[key];
+    }
+
+    [[nodiscard]] int getSize() const {  // Each shard is counted at a different moment under concurrent writes
+        int size = 0;
+        for (const Shard &shard: shards) {
+            shared_lock lock(shard.mutex);
+            size += shard.map.getSize();
+        }
+        return size;
+    }
+};
+
+
+// A snapshot written by HashMap::save, mapped read-only. Opening it reads only the header, so it takes the same time
+// for any size, and a lookup touches only the pages of its slots and its strings
+template<typename K, typename V>
+class MappedHashMap {
+    using Slot = HashMapSnapshotSlot<K, V>;
+
+    const char *data = nullptr;
+    size_t length = 0;
+    uint64_t slots = 0, size = 0;
+    const Slot *arr = nullptr;
+    const char *text = nullptr;
+    size_t text_size = 0;
+
+    // The file is not trusted: a slot pointing outside it never matches, and a table without a free slot is probed
+    // once around
+    template<typename Q>
+    const Slot *locate(const Q &key) const {
+        if (!data) return nullptr;
+        uint64_t h = key_hash<K>(key) | 1, i = h & (slots - 1);
+        for (uint64_t probes = 0; probes < slots && arr[i].hash; ++probes, i = (i + 1) & (slots - 1)) {
+            const Slot &slot = arr[i];
+            if (slot.hash == h && slot.key.fits(text_size) && slot.value.fits(text_size) && slot.key.get(text) == key)
+                return &slot;
+        }
+        return nullptr;
+    }
+
+public:
+    MappedHashMap() = default;
+
+    MappedHashMap(const MappedHashMap &) = delete;
+
+    MappedHashMap &operator=(const MappedHashMap &) = delete;
+
+    ~MappedHashMap() { close(); }
+
+    bool open(const string &path) {  // False if the file is missing or is not a snapshot of these types
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) return false;
+        struct stat st{};
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(HashMapSnapshotHeader))
+            p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        data = static_cast<const char *>(p);
+        length = st.st_size;
+        HashMapSnapshotHeader header{};
+        memcpy(&header, data, sizeof(header));
+        slots = header.slots;
+        size = header.size;
+        if (memcmp(header.magic, hash_map_snapshot_magic, sizeof(hash_map_snapshot_magic)) != 0 ||
+            header.slot_size != sizeof(Slot) || slots == 0 || (slots & (slots - 1)) ||
+            slots > (length - sizeof(header)) / sizeof(Slot)) {
+            close();
+            return false;
+        }
+        madvise(p, length, MADV_RANDOM);
+        arr = reinterpret_cast<const Slot *>(data + sizeof(header));
+        text = reinterpret_cast<const char *>(arr + slots);
+        text_size = length - (text - data);
+        return true;
+    }
+
+    void close() {
+        if (data) munmap(const_cast<char *>(data), length);
+        data = text = nullptr;
+        arr = nullptr;
+        length = text_size = slots = size = 0;
+    }
+
+    template<typename Q>
+    [[nodiscard]] bool contains(const Q &key) const { return locate(key) != nullptr; }
+
+    template<typename Q>
+    view_t<V> operator[](const Q &key) const {  // The value, a string as a view into the mapping, or V{}
+        const Slot *slot = locate(key);
+        return slot ? slot->value.get(text) : view_t<V>{};
+    }
+
+    [[nodiscard]] int getSize() const { return int(size); }
+};
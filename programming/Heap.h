@@ -0,0 +1,13 @@
+/*
+ * Heap usage, for the memory per entry that the benchmarks of the containers report
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <malloc.h>
+
+inline size_t heap_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;  // Large blocks are mmap()ed and only counted in hblkhd
+}
@@ -0,0 +1,462 @@
+/*
+ * MultiHashMap and MappedMultiHashMap of Task3.1.2(additional).cpp
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Snapshot.h"
+#include "Vector.h"
+
+using namespace std;
+
+template<typename T>
+class NodeIterator : public iterator<input_iterator_tag, T> {
+    T *p;
+
+public:
+    explicit NodeIterator(T *p) : p(p) {}
+
+    NodeIterator(const NodeIterator &it) : p(it.p) {}
+
+    bool operator!=(NodeIterator const &other) const { return p != other.p; }
+
+    bool operator==(NodeIterator const &other) const { return p == other.p; }
+
+    typename NodeIterator::reference operator*() const { return *p; }
+
+    NodeIterator &operator++() {
+        while ((++p)->null);
+        return *this;
+    }
+};
+
+
+// Header, slots, values, text. Written and read by the same build, the hashes are not portable
+struct MultiHashMapSnapshotHeader {
+    char magic[8];
+    uint64_t slots;  // A power of two, at least twice the size
+    uint64_t size;
+    uint64_t values;
+    uint64_t slot_size, value_size;  // A snapshot of other types is refused
+};
+
+inline constexpr char multi_hash_map_snapshot_magic[8] = "MHSNAP1";
+
+template<typename K>
+struct MultiHashMapSnapshotSlot {  // Linear probing from hash & (slots - 1)
+    uint64_t hash;  // hash | 1, 0 is a free slot
+    Stored<K> key;
+    uint64_t offset, size;  // The values of the key are values[offset, offset + size)
+};
+
+
+template<typename K, typename V>
+class MultiHashMap {
+    static const int default_size = 8;
+    static const int inline_size = 2;  // Most keys have one or two values, they stay in the slot
+    static const int set_size = 16;  // Longer lists also get an index for duplicate checks
+    constexpr static const double rehash_size = 0.3;
+
+    struct Node {
+        K key{};
+        V values[inline_size]{};  // The first values
+        int size = 0;  // Number of values
+        int offset = 0;  // The rest is in pool[offset, offset + capacity)
+        int capacity = 0;
+        int *index = nullptr;  // Open addressing set of value positions, -1 is free
+        int index_memory = 0;
+        bool deleted = false;
+        bool null = true;
+    };
+
+    Node *arr;
+    Vector<V> pool;  // Runs of values of the keys with more than inline_size values
+    int garbage;  // Pool values of runs that were outgrown or removed
+    int active_size;  // Size without deleted
+    int memory;
+    int general_size;  // Size with deleted
+    unordered_map<V, int> counts;  // Number of keys holding each value, so getUnique() is O(1)
+
+    void count(const V &v, int d) {
+        auto it = counts.try_emplace(v, 0).first;  // Unlike emplace, allocates only for a new value
+        if ((it->second += d) == 0) counts.erase(it);
+    }
+
+    const V &valueAt(const Node &n, int i) const {
+        return i < inline_size ? n.values[i] : pool[n.offset + i - inline_size];
+    }
+
+    bool has(const Node &n, const V &v) const {
+        if (n.index) {
+            for (size_t h = hash<V>{}(v);; ++h) {
+                int i = n.index[h & (n.index_memory - 1)];
+                if (i == -1) return false;
+                if (valueAt(n, i) == v) return true;
+            }
+        }
+        for (int i = 0; i < n.size; ++i)
+            if (valueAt(n, i) == v) return true;
+        return false;
+    }
+
+    void index(Node &n, int i) {  // Adds position i to the index of n
+        size_t h = hash<V>{}(valueAt(n, i));
+        while (n.index[h & (n.index_memory - 1)] != -1)
+            ++h;
+        n.index[h & (n.index_memory - 1)] = i;
+    }
+
+    void reindex(Node &n) {  // Twice as many positions as values
+        delete[] n.index;
+        n.index_memory = n.index_memory ? 2 * n.index_memory : 2 * set_size;
+        n.index = new int[n.index_memory];
+        for (int i = 0; i < n.index_memory; ++i)
+            n.index[i] = -1;
+        for (int i = 0; i < n.size; ++i)
+            index(n, i);
+    }
+
+    void compact() {  // Copies the live runs into a new pool once half of it is garbage
+        Vector<V> fresh;
+        fresh.reserve(pool.getSize() - garbage);
+        for (int i = 0; i < memory; ++i) {
+            Node &n = arr[i];
+            if (n.null || n.deleted || !n.capacity) continue;
+            int offset = fresh.getSize();
+            for (int j = 0; j < n.capacity; ++j)
+                fresh.add(std::move(pool[n.offset + j]));
+            n.offset = offset;
+        }
+        pool = std::move(fresh);
+        garbage = 0;
+    }
+
+    void append(Node &n, const V &v) {
+        if (n.size < inline_size) {
+            n.values[n.size] = v;
+        } else {
+            if (n.size - inline_size == n.capacity) {  // The run is full, it moves to the end of the pool twice as long
+                int offset = pool.getSize(), capacity = n.capacity ? 2 * n.capacity : inline_size;
+                for (int j = 0; j < n.capacity; ++j)
+                    pool.add(std::move(pool[n.offset + j]));  // The old run becomes garbage
+                for (int j = n.capacity; j < capacity; ++j)
+                    pool.emplace_back();
+                garbage += n.capacity;
+                n.offset = offset;
+                n.capacity = capacity;
+                if (garbage > 64 && 2 * garbage > pool.getSize()) compact();
+            }
+            pool[n.offset + n.size - inline_size] = v;
+        }
+        ++n.size;
+        if (n.size > set_size && 2 * n.size > n.index_memory) reindex(n);
+        else if (n.index) index(n, n.size - 1);
+        count(v, 1);
+    }
+
+    void clear(Node &n) {  // Drops the values of a removed key
+        for (int i = 0; i < n.size; ++i)
+            count(valueAt(n, i), -1);
+        delete[] n.index;
+        n.index = nullptr;
+        n.index_memory = 0;
+        garbage += n.capacity;
+        n.size = n.capacity = 0;
+    }
+
+    void rebuild(int n) {  // Moves every key into a table of n slots, the values in the pool stay in place
+        Node *past = arr;
+        int past_memory = memory;
+        memory = n;
+        general_size = active_size;
+        arr = new Node[memory + 1];
+        arr[memory].null = false;
+        for (int i = 0; i < past_memory; ++i) {
+            if (!past[i].null && !past[i].deleted) {
+                int h = hash<K>{}(past[i].key) % memory;
+                while (!arr[h].null)
+                    h = (h + 1) % memory;
+                arr[h] = std::move(past[i]);
+            }
+        }
+        delete[] past;
+    }
+
+    void resize() { rebuild(memory * 2); }
+
+    void rehash() { rebuild(memory); }
+
+public:
+    MultiHashMap() {
+        memory = default_size;
+        active_size = 0;
+        general_size = 0;
+        garbage = 0;
+        arr = new Node[memory + 1];
+        arr[memory].null = false;
+    }
+
+    MultiHashMap(const MultiHashMap &) = delete;
+
+    MultiHashMap &operator=(const MultiHashMap &) = delete;
+
+    ~MultiHashMap() {
+        for (int i = 0; i < memory; ++i)
+            delete[] arr[i].index;
+        delete[] arr;
+    }
+
+    bool add(const K &k, const V &v) {
+        if (active_size + 1 > int(rehash_size * memory)) resize();
+        else if (general_size > 2 * active_size) rehash();
+        int h = hash<K>{}(k) % memory;
+        int i = 0;
+        int first_deleted = -1;
+        while (!arr[h].null && i < memory) {
+            if (arr[h].key == k && !arr[h].deleted) {
+                if (has(arr[h], v)) return false;
+                append(arr[h], v);
+                return true;
+            }
+            if (arr[h].deleted && first_deleted == -1) first_deleted = h;
+            h = (h + 1) % memory;
+            ++i;
+        }
+        if (first_deleted == -1) {
+            arr[h].null = false;
+            ++general_size;
+        } else {
+            h = first_deleted;
+            arr[h].deleted = false;
+        }
+        arr[h].key = k;
+        append(arr[h], v);
+        ++active_size;
+        return true;
+    }
+
+    bool remove(const K &key) {
+        int h = hash<K>{}(key) % memory;
+        int i = 0;
+        while (!arr[h].null && i < memory) {
+            if (arr[h].key == key && !arr[h].deleted) {
+                clear(arr[h]);
+                arr[h].deleted = true;
+                --active_size;
+                return true;
+            }
+            h = (h + 1) % memory;
+            ++i;
+        }
+        return false;
+    }
+
+    Vector<V> operator[](const K &key) const {
+        int h = hash<K>{}(key) % memory;
+        int i = 0;
+        Vector<V> values;
+        while (!arr[h].null && i < memory) {
+            if (arr[h].key == key && !arr[h].deleted) {
+                values.reserve(arr[h].size);
+                for (int j = 0; j < arr[h].size; ++j)
+                    values.add(valueAt(arr[h], j));
+                break;
+            }
+            h = (h + 1) % memory;
+            ++i;
+        }
+        return values;
+    }
+
+    void print() {
+        for (const Node &it: *this) {
+            cout << it.key << " | [";
+            for (int i = 0; i < it.size; ++i)
+                cout << valueAt(it, i) << (i + 1 < it.size ? " " : "] ");
+            cout << (it.deleted ? "(deleted)" : "") << endl;
+        }
+    }
+
+    [[nodiscard]] int getSize() const { return active_size; }
+
+    [[nodiscard]] int getUnique() const { return int(counts.size()); }
+
+    [[nodiscard]] Vector<int> probeHistogram() const {  // [d] is the number of keys d slots after their home
+        Vector<int> histogram;
+        for (int i = 0; i < memory; ++i) {
+            if (arr[i].null || arr[i].deleted) continue;
+            int d = (i - int(hash<K>{}(arr[i].key) % memory) + memory) % memory;
+            while (d >= histogram.getSize())
+                histogram.add(0);
+            ++histogram[d];
+        }
+        return histogram;
+    }
+
+    bool save(const string &path) const {  // Writes a snapshot for MappedMultiHashMap, false if it could not
+        using Slot = MultiHashMapSnapshotSlot<K>;
+        int slots = 2;
+        while (slots < 2 * active_size) slots *= 2;
+        Vector<Slot> arr(slots, Slot{});
+        Vector<Stored<V>> values;
+        string text;
+        for (const Node &n: *this) {
+            if (n.deleted) continue;  // The iterator stops at removed keys too
+            uint64_t h = hash<K>{}(n.key) | 1;
+            int i = int(h & (slots - 1));
+            while (arr[i].hash) i = (i + 1) & (slots - 1);
+            arr[i] = {h, Stored<K>::put(n.key, text), uint64_t(values.getSize()), uint64_t(n.size)};
+            for (int j = 0; j < n.size; ++j)
+                values.add(Stored<V>::put(valueAt(n, j), text));
+        }
+        MultiHashMapSnapshotHeader header{{}, uint64_t(slots), uint64_t(active_size), uint64_t(values.getSize()),
+                                          sizeof(Slot), sizeof(Stored<V>)};
+        memcpy(header.magic, multi_hash_map_snapshot_magic, sizeof(multi_hash_map_snapshot_magic));
+        ofstream out(path, ios::binary);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(&arr[0]), streamsize(slots) * sizeof(Slot));
+        if (values.getSize())
+            out.write(reinterpret_cast<const char *>(&values[0]), streamsize(values.getSize()) * sizeof(Stored<V>));
+        out.write(text.data(), streamsize(text.size()));
+        return bool(out);
+    }
+
+    NodeIterator<Node> begin() {
+        for (int i = 0; i < memory; ++i)
+            if (!arr[i].null && !arr[i].deleted)
+                return NodeIterator<Node>(&arr[i]);
+        return end();
+    }
+
+    NodeIterator<Node> end() { return NodeIterator<Node>(&arr[memory]); }
+
+    [[nodiscard]] NodeIterator<const Node> begin() const {
+        for (int i = 0; i < memory; ++i)
+            if (!arr[i].null && !arr[i].deleted)
+                return NodeIterator<const Node>(&arr[i]);
+        return end();
+    }
+
+    [[nodiscard]] NodeIterator<const Node> end() const { return NodeIterator<const Node>(&arr[memory]); }
+};
+
+
+template<typename V>
+class MappedValues {  // The values of one key in a mapped snapshot
+    const Stored<V> *values;
+    int size;
+    const char *text;
+
+public:
+    MappedValues(const Stored<V> *values, int size, const char *text) : values(values), size(size), text(text) {}
+
+    [[nodiscard]] int getSize() const { return size; }
+
+    view_t<V> operator[](int i) const {  // A string as a view into the mapping
+        assert(0 <= i && i < size);
+        return values[i].get(text);
+    }
+};
+
+
+// A snapshot written by MultiHashMap::save, mapped read-only. Opening it reads only the header, so it takes the same
+// time for any size, and a lookup touches only the pages of its slots, its values and their strings
+template<typename K, typename V>
+class MappedMultiHashMap {
+    using Slot = MultiHashMapSnapshotSlot<K>;
+
+    const char *data = nullptr;
+    size_t length = 0;
+    uint64_t slots = 0, size = 0;
+    const Slot *arr = nullptr;
+    const Stored<V> *values = nullptr;
+    uint64_t value_count = 0;
+    const char *text = nullptr;
+    size_t text_size = 0;
+
+public:
+    MappedMultiHashMap() = default;
+
+    MappedMultiHashMap(const MappedMultiHashMap &) = delete;
+
+    MappedMultiHashMap &operator=(const MappedMultiHashMap &) = delete;
+
+    ~MappedMultiHashMap() { close(); }
+
+    bool open(const string &path) {  // False if the file is missing or is not a snapshot of these types
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) return false;
+        struct stat st{};
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(MultiHashMapSnapshotHeader))
+            p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        data = static_cast<const char *>(p);
+        length = st.st_size;
+        MultiHashMapSnapshotHeader header{};
+        memcpy(&header, data, sizeof(header));
+        slots = header.slots;
+        size = header.size;
+        size_t rest = length - sizeof(header);
+        if (memcmp(header.magic, multi_hash_map_snapshot_magic, sizeof(multi_hash_map_snapshot_magic)) != 0 ||
+            header.slot_size != sizeof(Slot) || header.value_size != sizeof(Stored<V>) || slots == 0 ||
+            (slots & (slots - 1)) || slots > rest / sizeof(Slot) ||
+            header.values > (rest - slots * sizeof(Slot)) / sizeof(Stored<V>)) {
+            close();
+            return false;
+        }
+        madvise(p, length, MADV_RANDOM);
+        arr = reinterpret_cast<const Slot *>(data + sizeof(header));
+        values = reinterpret_cast<const Stored<V> *>(arr + slots);
+        value_count = header.values;
+        text = reinterpret_cast<const char *>(values + value_count);
+        text_size = length - (text - data);
+        return true;
+    }
+
+    void close() {
+        if (data) munmap(const_cast<char *>(data), length);
+        data = text = nullptr;
+        arr = nullptr;
+        values = nullptr;
+        length = value_count = text_size = slots = size = 0;
+    }
+
+    // No values if the key is missing. The file is not trusted: a slot pointing outside it never matches, and a
+    // table without a free slot is probed once around
+    MappedValues<V> operator[](const K &key) const {
+        if (!data) return MappedValues<V>(nullptr, 0, text);
+        uint64_t h = hash<K>{}(key) | 1, i = h & (slots - 1);
+        for (uint64_t probes = 0; probes < slots && arr[i].hash; ++probes, i = (i + 1) & (slots - 1)) {
+            const Slot &slot = arr[i];
+            if (slot.hash != h || !slot.key.fits(text_size) || slot.key.get(text) != key) continue;
+            if (slot.offset > value_count || slot.size > value_count - slot.offset) continue;
+            bool fits = true;
+            for (uint64_t j = 0; j < slot.size && fits; ++j)
+                fits = values[slot.offset + j].fits(text_size);
+            if (fits) return MappedValues<V>(values + slot.offset, int(slot.size), text);
+        }
+        return MappedValues<V>(nullptr, 0, text);
+    }
+
+    [[nodiscard]] int getSize() const { return int(size); }
+};
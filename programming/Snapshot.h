@@ -0,0 +1,47 @@
+/*
+ * How HashMap and MultiHashMap snapshots store keys and values, read back through mmap
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+using namespace std;
+
+
+// A snapshot stores a string as the offset and length of its bytes in the text at the end of the snapshot, and any
+// other type as its own bytes
+template<typename T, bool = is_same_v<T, string>>
+struct Stored {
+    static_assert(is_trivially_copyable_v<T>, "a snapshot holds strings and trivially copyable types");
+    T value;
+
+    static Stored put(const T &v, string &) { return {v}; }
+
+    [[nodiscard]] bool fits(size_t) const { return true; }
+
+    [[nodiscard]] T get(const char *) const { return value; }
+};
+
+template<typename T>
+struct Stored<T, true> {
+    uint64_t offset, length;
+
+    static Stored put(const string &v, string &text) {
+        Stored s{text.size(), v.size()};
+        text += v;
+        return s;
+    }
+
+    [[nodiscard]] bool fits(size_t text_size) const {  // False in a corrupt or truncated snapshot
+        return offset <= text_size && length <= text_size - offset;
+    }
+
+    [[nodiscard]] string_view get(const char *text) const { return {text + offset, size_t(length)}; }
+};
+
+template<typename T>
+using view_t = conditional_t<is_same_v<T, string>, string_view, T>;  // A value read from a snapshot
@@ -1,9 +1,33 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <new>
 #include <stack>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <list>
+#include <malloc.h>
 
 using namespace std;
 
@@ -32,28 +56,187 @@ enum ExpressionType {
     etn, etv, eta, ets, etm, etd
 };
 
+class NodeArena {  // Bump allocator for the nodes of one thread, memory is released all at once by reset()
+private:
+    static const size_t block_size = 1 << 20;
+
+    vector<char *> _blocks;
+    size_t _block = 0;  // Block in use
+    size_t _used = 0;  // Bytes used in it
+    size_t _allocations = 0;  // Since construction
+
+public:
+    inline static thread_local NodeArena *current = nullptr;  // Arena of this thread, if any
+
+    NodeArena() = default;
+
+    NodeArena(const NodeArena &) = delete;
+
+    NodeArena &operator=(const NodeArena &) = delete;
+
+    ~NodeArena() {
+        for (char *block: _blocks) ::operator delete(block);
+    }
+
+    void *allocate(size_t size) {
+        size = (size + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+        if (size > block_size) throw bad_alloc();
+        if (_blocks.empty() || _used + size > block_size) {
+            if (!_blocks.empty()) ++_block;
+            if (_block == _blocks.size()) _blocks.push_back((char *) ::operator new(block_size));
+            _used = 0;
+        }
+        void *p = _blocks[_block] + _used;
+        _used += size;
+        ++_allocations;
+        return p;
+    }
+
+    [[nodiscard]] size_t getAllocations() const { return _allocations; }
+
+    void reset() {  // Blocks are kept for reuse
+        _block = 0;
+        _used = 0;
+    }
+};
+
+const char operation_symbols[] = "  +-*/";  // Indexed by ExpressionType
+
+class Expression;
+
+// Traversals with an explicit stack, so the depth of a tree is not limited by the native stack
+int evaluate(Expression *root, const string &s);
+
+class DerivativeCache;
+
+// With a cache, each node is differentiated once per variable and equal new subtrees are shared
+Expression *differentiate(Expression *root, const string &s, DerivativeCache *cache = nullptr);
+
+string serialize(Expression *root);
+
+void write_expression(Expression *root, int fd);
+
+bool has_variable(Expression *root);
+
+#ifdef EXPR_STATS  // Compile with -DEXPR_STATS to collect statistics, otherwise the STATS_ hooks are empty
+enum StatsPhase {
+    sp_parse, sp_derivative, sp_simplify, sp_print, sp_count
+};
+
+struct ExpressionStats {
+    struct Tree {
+        string name;
+        size_t count, max_size, max_depth;
+    };
+
+    inline static atomic<int64_t> created[6];  // Indexed by ExpressionType
+    inline static atomic<int64_t> live, peak_live;
+    inline static atomic<int64_t> phase_ns[sp_count], phase_calls[sp_count];
+    inline static mutex trees_mutex;
+    inline static vector<Tree> trees;
+
+    static void nodeCreated(ExpressionType type) {
+        created[type].fetch_add(1, memory_order_relaxed);
+        int64_t now = live.fetch_add(1, memory_order_relaxed) + 1;
+        for (int64_t peak = peak_live.load(memory_order_relaxed);
+             now > peak && !peak_live.compare_exchange_weak(peak, now, memory_order_relaxed););
+    }
+
+    static void nodeDestroyed() { live.fetch_sub(1, memory_order_relaxed); }
+
+    static void tree(const string &name, Expression *root);  // Size in distinct nodes and depth
+
+    static void writeJson(ostream &out) {
+        static const char *phase_names[] = {"parse", "derivative", "simplify", "print"};
+        static const char *type_names[] = {"Number", "Variable", "Add", "Sub", "Mul", "Div"};
+        out << "{\"phases\": {";
+        for (int p = 0; p < sp_count; ++p) {
+            out << (p ? ", " : "") << '"' << phase_names[p] << "\": {\"calls\": " << phase_calls[p]
+                << ", \"ms\": " << double(phase_ns[p]) / 1e6 << '}';
+        }
+        out << "}, \"nodes\": {\"created\": {";
+        for (int t = 0; t < 6; ++t) out << (t ? ", " : "") << '"' << type_names[t] << "\": " << created[t];
+        out << "}, \"live\": " << live << ", \"peak_live\": " << peak_live << "}, \"trees\": {";
+        lock_guard<mutex> lock{trees_mutex};
+        for (size_t i = 0; i < trees.size(); ++i) {
+            out << (i ? ", " : "") << '"' << trees[i].name << "\": {\"count\": " << trees[i].count
+                << ", \"max_size\": " << trees[i].max_size << ", \"max_depth\": " << trees[i].max_depth << '}';
+        }
+        out << "}}" << endl;
+    }
+};
+
+class PhaseTimer {
+private:
+    StatsPhase _phase;
+    chrono::steady_clock::time_point _start;
+
+public:
+    explicit PhaseTimer(StatsPhase phase) : _phase(phase), _start(chrono::steady_clock::now()) {}
+
+    ~PhaseTimer() {
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - _start).count();
+        ExpressionStats::phase_ns[_phase].fetch_add(ns, memory_order_relaxed);
+        ExpressionStats::phase_calls[_phase].fetch_add(1, memory_order_relaxed);
+    }
+};
+
+#define STATS_NODE_CREATED(type) ExpressionStats::nodeCreated(type)
+#define STATS_NODE_DESTROYED() ExpressionStats::nodeDestroyed()
+#define STATS_PHASE(phase) PhaseTimer stats_phase_timer{phase}
+#define STATS_TREE(name, root) ExpressionStats::tree(name, root)
+#define STATS_JSON(out) ExpressionStats::writeJson(out)
+#else  // Still statements, so that if (stats) STATS_JSON(cerr); has a body
+#define STATS_NODE_CREATED(type) ((void) 0)
+#define STATS_NODE_DESTROYED() ((void) 0)
+#define STATS_PHASE(phase) ((void) 0)
+#define STATS_TREE(name, root) ((void) 0)
+#define STATS_JSON(out) ((void) 0)
+#endif
+
 class Expression {  // Abstract class
 private:
     ExpressionType _type;
 protected:
-    stack<Expression *> _allocated;
+    stack<Expression *, vector<Expression *>> _allocated;
+
+    friend Expression *differentiate(Expression *, const string &, DerivativeCache *);
 
 public:
-    virtual ~Expression() {
-        while (!_allocated.empty()) {
-            delete _allocated.top();
-            _allocated.pop();
+    virtual ~Expression() {  // Owned nodes are deleted by the outermost destructor, not recursively
+        STATS_NODE_DESTROYED();
+        static thread_local vector<Expression *> pending;
+        static thread_local bool draining = false;
+        for (; !_allocated.empty(); _allocated.pop()) pending.push_back(_allocated.top());
+        if (draining) return;
+        draining = true;
+        while (!pending.empty()) {
+            Expression *e = pending.back();
+            pending.pop_back();
+            delete e;
         }
+        draining = false;
     }
 
-    virtual ExpressionType getType() { return _type; }
+    explicit Expression(ExpressionType type) : _type(type) { STATS_NODE_CREATED(type); }
+
+    // While a thread has an arena, its nodes must be created and deleted under it
+    static void *operator new(size_t size) {
+        return NodeArena::current ? NodeArena::current->allocate(size) : ::operator new(size);
+    }
+
+    [[gnu::noinline]] static void operator delete(void *p) {  // noinline keeps -Wmismatched-new-delete quiet
+        if (!NodeArena::current) ::operator delete(p);
+    }
+
+    [[nodiscard]] ExpressionType getType() const { return _type; }
 
     virtual Expression *derivative(string s) = 0;
 
     virtual string toString() = 0;
 
     void print() {  // For inheritance only
-        cout << toString() << endl;
+        write_expression(this, STDOUT_FILENO);
     }
 
     virtual int eval(string s) = 0;
@@ -64,12 +247,11 @@ public:
 class Number : public Expression {
 private:
     int _n;
-    ExpressionType _type;
 
-    string toString() override { return to_string(_n); }
+    string toString() override { return serialize(this); }
 
 public:
-    explicit Number(const int &n = 0) : _n(n), _type(etn) {}
+    explicit Number(const int &n = 0) : Expression(etn), _n(n) {}
 
     Number *derivative(string s) override {
         _allocated.push(new Number{0});
@@ -79,19 +261,16 @@ public:
     int eval(string s) override { return _n; }
 
     [[nodiscard]] int getN() const { return _n; }
-
-    ExpressionType getType() override { return _type; }
 };
 
 class Variable : public Expression {
 private:
     string _s;
-    ExpressionType _type;
 
     string toString() override { return _s; }
 
 public:
-    explicit Variable(string s) : _s(std::move(s)), _type(etv) {}
+    explicit Variable(string s) : Expression(etv), _s(std::move(s)) {}
 
     Number *derivative(string s) override {
         _allocated.push(new Number{_s == s ? 1 : 0});
@@ -102,126 +281,91 @@ public:
 
     bool isVarInExp() override { return true; }
 
-    string getS() { return _s; }
-
-    ExpressionType getType() override { return _type; }
+    [[nodiscard]] const string &getS() const { return _s; }
 };
 
 class Add : public Expression {
 private:
     Expression *_first;
     Expression *_second;
-    ExpressionType _type;
 
-    string toString() override { return "(" + _first->toString() + "+" + _second->toString() + ")"; }
+    string toString() override { return serialize(this); }
 
 public:
-    Add(Expression *first, Expression *second) : _first(first), _second(second), _type(eta) {}
+    Add(Expression *first, Expression *second) : Expression(eta), _first(first), _second(second) {}
 
-    Add *derivative(string s) override {
-        _allocated.push(new Add{_first->derivative(s), _second->derivative(s)});
-        return (Add *) _allocated.top();
-    }
+    Add *derivative(string s) override { return (Add *) differentiate(this, s); }
 
-    int eval(string s) override { return _first->eval(s) + _second->eval(s); }
+    int eval(string s) override { return evaluate(this, s); }
 
-    bool isVarInExp() override { return _first->isVarInExp() || _second->isVarInExp(); }
+    bool isVarInExp() override { return has_variable(this); }
 
     Expression *getFirst() { return _first; }
 
     Expression *getSecond() { return _second; }
-
-    ExpressionType getType() override { return _type; }
 };
 
 class Sub : public Expression {
 private:
     Expression *_first;
     Expression *_second;
-    ExpressionType _type;
 
-    string toString() override { return "(" + _first->toString() + "-" + _second->toString() + ")"; }
+    string toString() override { return serialize(this); }
 
 public:
-    Sub(Expression *first, Expression *second) : _first(first), _second(second), _type(ets) {}
+    Sub(Expression *first, Expression *second) : Expression(ets), _first(first), _second(second) {}
 
-    Sub *derivative(string s) override {
-        _allocated.push(new Sub{_first->derivative(s), _second->derivative(s)});
-        return (Sub *) _allocated.top();
-    }
+    Sub *derivative(string s) override { return (Sub *) differentiate(this, s); }
 
-    int eval(string s) override { return _first->eval(s) - _second->eval(s); }
+    int eval(string s) override { return evaluate(this, s); }
 
-    bool isVarInExp() override { return _first->isVarInExp() || _second->isVarInExp(); }
+    bool isVarInExp() override { return has_variable(this); }
 
     Expression *getFirst() { return _first; }
 
     Expression *getSecond() { return _second; }
-
-    ExpressionType getType() override { return _type; }
 };
 
 class Mul : public Expression {
 private:
     Expression *_first;
     Expression *_second;
-    ExpressionType _type;
 
-    string toString() override { return "(" + _first->toString() + "*" + _second->toString() + ")"; }
+    string toString() override { return serialize(this); }
 
 public:
-    Mul(Expression *first, Expression *second) : _first(first), _second(second), _type(etm) {}
+    Mul(Expression *first, Expression *second) : Expression(etm), _first(first), _second(second) {}
 
-    Add *derivative(string s) override {
-        _allocated.push(new Add{
-                new Mul{_first->derivative(s), _second},
-                new Mul{_first, _second->derivative(s)}
-        });
-        return (Add *) _allocated.top();
-    }
+    Add *derivative(string s) override { return (Add *) differentiate(this, s); }
 
-    int eval(string s) override { return _first->eval(s) * _second->eval(s); }
+    int eval(string s) override { return evaluate(this, s); }
 
-    bool isVarInExp() override { return _first->isVarInExp() || _second->isVarInExp(); }
+    bool isVarInExp() override { return has_variable(this); }
 
     Expression *getFirst() { return _first; }
 
     Expression *getSecond() { return _second; }
-
-    ExpressionType getType() override { return _type; }
 };
 
 class Div : public Expression {
 private:
     Expression *_first;
     Expression *_second;
-    ExpressionType _type;
 
-    string toString() override { return "(" + _first->toString() + "/" + _second->toString() + ")"; }
+    string toString() override { return serialize(this); }
 
 public:
-    Div(Expression *first, Expression *second) : _first(first), _second(second), _type(ExpressionType::etd) {}
-
-    Div *derivative(string s) override {
-        _allocated.push(new Div{
-                new Sub{
-                        new Mul{_first->derivative(s), _second},
-                        new Mul{_first, _second->derivative(s)}
-                },
-                new Mul{_second, _second}
-        });
-        return (Div *) _allocated.top();
-    }
+    Div(Expression *first, Expression *second) : Expression(etd), _first(first), _second(second) {}
+
+    Div *derivative(string s) override { return (Div *) differentiate(this, s); }
 
-    int eval(string s) override { return _first->eval(s) / _second->eval(s); }
+    int eval(string s) override { return evaluate(this, s); }
 
-    bool isVarInExp() override { return _first->isVarInExp() || _second->isVarInExp(); }
+    bool isVarInExp() override { return has_variable(this); }
 
     Expression *getFirst() { return _first; }
 
     Expression *getSecond() { return _second; }
-
-    ExpressionType getType() override { return _type; }
 };
 
 void example() {
@@ -238,41 +382,394 @@ void example() {
     dey->print();
 }
 
-Expression *extract_expression(string s, stack<Expression *> &allocated) {
-    int cnt = 0;
-    for (int i = 0; i < s.size(); ++i) {
-        if (s[i] == '(') ++cnt;
-        else if (s[i] == ')') --cnt;
-        else if (cnt == 0) {  // If there are only numbers and variables left
-            if ('0' <= s[i] && s[i] <= '9') {  // Number
-                int result = s[i] - '0';
-                for (int j = i + 1; j < s.size(); ++j) {
-                    result = result * 10 + (s[j] - '0');
-                }
-                allocated.push(new Number{result});
-            } else {  // Variable
-                string result{s[i]};
-                for (int j = i + 1; j < s.size(); ++j) {
-                    result += s[j];
+pair<Expression *, Expression *> children(Expression *e) {  // {nullptr, nullptr} for Number and Variable
+    switch (e->getType()) {
+        case eta:
+            return {((Add *) e)->getFirst(), ((Add *) e)->getSecond()};
+        case ets:
+            return {((Sub *) e)->getFirst(), ((Sub *) e)->getSecond()};
+        case etm:
+            return {((Mul *) e)->getFirst(), ((Mul *) e)->getSecond()};
+        case etd:
+            return {((Div *) e)->getFirst(), ((Div *) e)->getSecond()};
+        default:
+            return {nullptr, nullptr};
+    }
+}
+
+Expression *make_operation(char op, Expression *first, Expression *second) {
+    if (op == '+') return new Add{first, second};
+    if (op == '-') return new Sub{first, second};
+    if (op == '*') return new Mul{first, second};
+    return new Div{first, second};
+}
+
+class DerivativeCache {  // For one session, nodes must outlive it
+private:
+    struct Key {  // Type and children of a created node, or etn and the value of a Number
+        ExpressionType type;
+        intptr_t first, second;
+
+        bool operator==(const Key &o) const { return type == o.type && first == o.first && second == o.second; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            size_t h = hash<intptr_t>{}(k.first) * 31 + hash<intptr_t>{}(k.second);
+            return h * 31 + k.type;
+        }
+    };
+
+    unordered_map<string, unordered_map<Expression *, Expression *>> _memo;  // Variable -> node -> derivative
+    unordered_map<Key, Expression *, KeyHash> _nodes;  // Equal created subtrees are one node
+
+    friend Expression *differentiate(Expression *, const string &, DerivativeCache *);
+
+public:
+    Expression *derivative(Expression *e, const string &s) { return differentiate(e, s, this); }
+
+    [[nodiscard]] size_t getSize() const { return _nodes.size(); }
+};
+
+// New nodes are owned by the differentiated ones
+Expression *differentiate(Expression *root, const string &s, DerivativeCache *cache) {
+    unordered_map<Expression *, Expression *> *memo = cache ? &cache->_memo[s] : nullptr;
+    auto make = [cache](Expression *owner, ExpressionType type, intptr_t first, intptr_t second) {
+        DerivativeCache::Key key{type, first, second};
+        if (cache) {
+            auto it = cache->_nodes.find(key);
+            if (it != cache->_nodes.end()) return it->second;
+        }
+        Expression *node = type == etn ? new Number{int(first)} : make_operation(
+                operation_symbols[type], (Expression *) first, (Expression *) second);
+        owner->_allocated.push(node);
+        if (cache) cache->_nodes.emplace(key, node);
+        return node;
+    };
+    auto op = [&make](Expression *owner, ExpressionType type, Expression *first, Expression *second) {
+        return make(owner, type, intptr_t(first), intptr_t(second));
+    };
+    vector<Expression *> derivatives;
+    vector<pair<Expression *, bool>> st{{root, false}};  // <node, children are already differentiated>
+    while (!st.empty()) {
+        auto [e, ready] = st.back();
+        st.pop_back();
+        auto [first, second] = children(e);
+        if (memo && !ready) {
+            auto it = memo->find(e);
+            if (it != memo->end()) {
+                derivatives.push_back(it->second);
+                continue;
+            }
+        }
+        if (!first) {
+            if (!cache) derivatives.push_back(e->derivative(s));
+            else derivatives.push_back(make(e, etn, e->getType() == etv && ((Variable *) e)->getS() == s, 0));
+        } else if (!ready) {
+            st.emplace_back(e, true);
+            st.emplace_back(second, false);
+            st.emplace_back(first, false);
+            continue;
+        } else {
+            Expression *d_second = derivatives.back();
+            derivatives.pop_back();
+            Expression *d_first = derivatives.back();
+            switch (e->getType()) {
+                case eta:
+                case ets:
+                    derivatives.back() = op(e, e->getType(), d_first, d_second);
+                    break;
+                case etm:
+                    derivatives.back() = op(e, eta, op(e, etm, d_first, second), op(e, etm, first, d_second));
+                    break;
+                default:
+                    derivatives.back() = op(e, etd, op(e, ets, op(e, etm, d_first, second), op(e, etm, first, d_second)),
+                                            op(e, etm, second, second));
+            }
+        }
+        if (memo) (*memo)[e] = derivatives.back();
+    }
+    return derivatives.back();
+}
+
+
+void append_number(string &out, int n) {  // A negative number as (0-n), so that the parser reads it back
+    if (n == numeric_limits<int>::min()) {
+        out += "(0-2147483647-1)";
+        return;
+    }
+    if (n < 0) out += "(0-";
+    char digits[16];
+    out.append(digits, to_chars(digits, digits + sizeof digits, n < 0 ? -n : n).ptr);
+    if (n < 0) out += ')';
+}
+
+class ExpressionWriter {  // Appends to one buffer, which is flushed to fd whenever it gets large
+private:
+    static const size_t flush_size = 1 << 16;
+
+    string _buffer;
+    int _fd;  // -1 to keep everything in the buffer
+
+public:
+    explicit ExpressionWriter(int fd = -1) : _fd(fd) {}
+
+    ExpressionWriter(const ExpressionWriter &) = delete;
+
+    ExpressionWriter &operator=(const ExpressionWriter &) = delete;
+
+    ~ExpressionWriter() { flush(); }
+
+    void write(char c) { _buffer += c; }
+
+    void write(Expression *root) {
+        vector<pair<Expression *, char>> st{{root, 0}};  // Node or, if it is nullptr, a char to print
+        while (!st.empty()) {
+            auto [e, c] = st.back();
+            st.pop_back();
+            if (_fd >= 0 && _buffer.size() >= flush_size) flush();
+            if (!e) {
+                _buffer += c;
+                continue;
+            }
+            auto [first, second] = children(e);
+            if (first) {
+                st.emplace_back(nullptr, ')');
+                st.emplace_back(second, 0);
+                st.emplace_back(nullptr, operation_symbols[e->getType()]);
+                st.emplace_back(first, 0);
+                st.emplace_back(nullptr, '(');
+            } else if (e->getType() == etn) {
+                append_number(_buffer, ((Number *) e)->getN());
+            } else {
+                _buffer += ((Variable *) e)->getS();
+            }
+        }
+    }
+
+    void flush() {
+        if (_fd < 0) return;
+        for (size_t done = 0; done < _buffer.size();) {
+            ssize_t n = ::write(_fd, _buffer.data() + done, _buffer.size() - done);
+            if (n < 0 && errno != EINTR) break;
+            if (n > 0) done += n;
+        }
+        _buffer.clear();
+    }
+
+    string take() { return std::move(_buffer); }
+};
+
+string serialize(Expression *root) {
+    ExpressionWriter writer;
+    writer.write(root);
+    return writer.take();
+}
+
+void write_expression(Expression *root, int fd) {
+    cout.flush();
+    ExpressionWriter writer{fd};
+    writer.write(root);
+    writer.write('\n');
+}
+
+#ifdef EXPR_STATS
+void ExpressionStats::tree(const string &name, Expression *root) {
+    unordered_map<Expression *, size_t> depth;
+    vector<pair<Expression *, bool>> st{{root, false}};  // <node, children are already measured>
+    while (!st.empty()) {
+        auto [e, ready] = st.back();
+        st.pop_back();
+        if (depth.count(e)) continue;
+        auto [first, second] = children(e);
+        if (first && !ready) {
+            st.emplace_back(e, true);
+            st.emplace_back(second, false);
+            st.emplace_back(first, false);
+        } else {
+            depth[e] = first ? 1 + max(depth[first], depth[second]) : 1;
+        }
+    }
+    lock_guard<mutex> lock{trees_mutex};
+    auto it = find_if(trees.begin(), trees.end(), [&name](const Tree &t) { return t.name == name; });
+    if (it == trees.end()) it = trees.insert(trees.end(), Tree{name, 0, 0, 0});
+    ++it->count;
+    it->max_size = max(it->max_size, depth.size());
+    it->max_depth = max(it->max_depth, depth[root]);
+}
+#endif
+
+bool has_variable(Expression *root) {
+    vector<Expression *> st{root};
+    while (!st.empty()) {
+        Expression *e = st.back();
+        st.pop_back();
+        auto [first, second] = children(e);
+        if (!first && e->getType() == etv) return true;
+        if (first) {
+            st.push_back(second);
+            st.push_back(first);
+        }
+    }
+    return false;
+}
+
+struct Interval {  // All reals between lo and hi
+    double lo, hi;
+
+    Interval(double v = 0) : lo(v), hi(v) {}  // A constant, [v, v]
+
+    Interval(double lo, double hi) : lo(lo), hi(hi) {}
+
+    Interval operator+(const Interval &o) const { return {lo + o.lo, hi + o.hi}; }
+
+    Interval operator-(const Interval &o) const { return {lo - o.hi, hi - o.lo}; }
+
+    Interval operator*(const Interval &o) const {
+        auto mul = [](double x, double y) { return x == 0 || y == 0 ? 0.0 : x * y; };  // 0 * inf is 0 here, not nan
+        double a = mul(lo, o.lo), b = mul(lo, o.hi), c = mul(hi, o.lo), d = mul(hi, o.hi);
+        return {min({a, b, c, d}), max({a, b, c, d})};
+    }
+
+    Interval operator/(const Interval &o) const {
+        if (o.lo <= 0 && 0 <= o.hi) return {-numeric_limits<double>::infinity(), numeric_limits<double>::infinity()};
+        return *this * Interval{1 / o.hi, 1 / o.lo};
+    }
+};
+
+template<typename T>
+struct Domain {  // int and int64_t throw where the division would trap, double and Interval divide as is
+    static T divide(const T &a, const T &b) {
+        if constexpr (is_integral_v<T>) {
+            if (b == 0) throw domain_error("division by zero");
+            if (b == -1 && a == numeric_limits<T>::min()) throw domain_error("division overflow");
+        }
+        return a / b;
+    }
+};
+
+template<typename T, typename Leaf>
+T evaluate_with(Expression *root, const Leaf &leaf) {  // leaf(e) is the value of a Number or a Variable
+    vector<T> values;
+    vector<pair<Expression *, bool>> st{{root, false}};  // <node, children are already evaluated>
+    while (!st.empty()) {
+        auto [e, ready] = st.back();
+        st.pop_back();
+        auto [first, second] = children(e);
+        if (!first) {
+            values.push_back(leaf(e));
+        } else if (!ready) {
+            st.emplace_back(e, true);
+            st.emplace_back(second, false);
+            st.emplace_back(first, false);
+        } else {
+            T b = values.back();
+            values.pop_back();
+            T &a = values.back();
+            switch (e->getType()) {
+                case eta: a = a + b; break;
+                case ets: a = a - b; break;
+                case etm: a = a * b; break;
+                default: a = Domain<T>::divide(a, b);
+            }
+        }
+    }
+    return values.back();
+}
+
+template<typename T>
+T evaluate_as(Expression *root, const unordered_map<string, T> &point) {  // Unknown variables are 0
+    return evaluate_with<T>(root, [&point](Expression *e) {
+        if (e->getType() == etn) return T(((Number *) e)->getN());
+        auto it = point.find(((Variable *) e)->getS());
+        return it == point.end() ? T(0) : it->second;
+    });
+}
+
+int evaluate(Expression *root, const string &s) {
+    return evaluate_with<int>(root, [&s](Expression *e) { return e->eval(s); });
+}
+
+bool isOperation(char c) { return c == '+' || c == '-' || c == '*' || c == '/'; }  // For additional task 1
+
+bool isDigit(char c) { return '0' <= c && c <= '9'; }  // For additional task 1
+
+bool isCharOfVar(char c) { return !isOperation(c) && !isDigit(c) && c != '(' && c != ')'; }  // For additional task 1
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+class ParseError : public runtime_error {
+private:
+    size_t _pos;
+
+public:
+    ParseError(const string &message, size_t pos) : runtime_error(message + " at position " + to_string(pos)),
+                                                     _pos(pos) {}
+
+    [[nodiscard]] size_t getPos() const { return _pos; }
+};
+
+int precedence(char op) { return op == '*' || op == '/' ? 2 : 1; }
+
+// Shunting-yard: one pass over s, nodes are built directly, brackets are optional
+Expression *parse_expression(string_view s, stack<Expression *> &allocated) {
+    vector<Expression *> operands;
+    vector<pair<char, size_t>> operators;  // <operation or '(', position>
+    bool expect_operand = true;
+    auto reduce = [&]() {
+        char op = operators.back().first;
+        operators.pop_back();
+        Expression *second = operands.back();
+        operands.pop_back();
+        allocated.push(make_operation(op, operands.back(), second));
+        operands.back() = allocated.top();
+    };
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if (isSpace(c)) continue;
+        if (expect_operand) {
+            if (c == '(') {
+                operators.emplace_back(c, i);
+            } else if (isDigit(c)) {
+                long long n = c - '0';
+                for (; i + 1 < s.size() && isDigit(s[i + 1]); ++i) {
+                    n = n * 10 + (s[i + 1] - '0');
+                    if (n > numeric_limits<int>::max()) throw ParseError("number is too large", i + 1);
                 }
-                allocated.push(new Variable{result});
+                allocated.push(new Number{int(n)});
+                operands.push_back(allocated.top());
+                expect_operand = false;
+            } else if (isCharOfVar(c)) {
+                size_t i_start = i;
+                for (; i + 1 < s.size() && isCharOfVar(s[i + 1]) && !isSpace(s[i + 1]); ++i);
+                allocated.push(new Variable{string{s.substr(i_start, i - i_start + 1)}});
+                operands.push_back(allocated.top());
+                expect_operand = false;
+            } else {
+                throw ParseError(string{"expected number, variable or '(' but found '"} + c + "'", i);
+            }
+        } else {
+            if (c == ')') {
+                while (!operators.empty() && operators.back().first != '(') reduce();
+                if (operators.empty()) throw ParseError("unmatched ')'", i);
+                operators.pop_back();
+            } else if (isOperation(c)) {
+                while (!operators.empty() && operators.back().first != '(' &&
+                       precedence(operators.back().first) >= precedence(c))
+                    reduce();
+                operators.emplace_back(c, i);
+                expect_operand = true;
+            } else {
+                throw ParseError(string{"expected operation or ')' but found '"} + c + "'", i);
             }
-            return allocated.top();
-        } else if (cnt == 1) {  // If the first Monomial is over. We found the last operation
-            while (s[i] != '+' && s[i] != '-' && s[i] != '*' && s[i] != '/') ++i;
-            char sign = s[i];
-            string first = s.substr(1, i - 1), second = s.substr(i + 1, s.size() - i - 2);
-            if (sign == '+')
-                allocated.push(new Add{extract_expression(first, allocated), extract_expression(second, allocated)});
-            else if (sign == '-')
-                allocated.push(new Sub{extract_expression(first, allocated), extract_expression(second, allocated)});
-            else if (sign == '*')
-                allocated.push(new Mul{extract_expression(first, allocated), extract_expression(second, allocated)});
-            else if (sign == '/')
-                allocated.push(new Div{extract_expression(first, allocated), extract_expression(second, allocated)});
-            return allocated.top();
         }
     }
+    if (expect_operand) throw ParseError("unexpected end of expression", s.size());
+    while (!operators.empty()) {
+        if (operators.back().first == '(') throw ParseError("unmatched '('", operators.back().second);
+        reduce();
+    }
+    return operands.back();
 }
 
 void deallocating(stack<Expression *> &allocated) {
@@ -287,19 +784,13 @@ void main_task() {
     string s;
     cin >> s;
 
-    Expression *e = extract_expression(s, allocated);
+    Expression *e = parse_expression(s, allocated);
     Expression *de = e->derivative("x");
     de->print();
 
     deallocating(allocated);
 }
 
-bool isOperation(char c) { return c == '+' || c == '-' || c == '*' || c == '/'; }  // For additional task 1
-
-bool isDigit(char c) { return '0' <= c && c <= '9'; }  // For additional task 1
-
-bool isCharOfVar(char c) { return !isOperation(c) && !isDigit(c) && c != '(' && c != ')'; }  // For additional task 1
-
 enum MonomialTypes {  // For additional task 1
     num, var, operation
 };
@@ -364,71 +855,909 @@ string adding_brackets(const string &s) {  // Additional task 1
     return l.back().first;  // l.size() == 1
 }
 
+class Simplifier {  // Bottom-up rewriting with memoized results, unchanged subtrees are returned as is
+private:
+    struct Rule {  // Returns the replacement of first <type> second or nullptr if the rule does not apply
+        ExpressionType type;
+        Expression *(*apply)(Simplifier &, Expression *first, Expression *second);
+    };
+
+    static bool isNumber(Expression *e, int n) { return e->getType() == etn && ((Number *) e)->getN() == n; }
+
+    static const vector<Rule> &rules() {
+        static const vector<Rule> r{
+                {eta, [](Simplifier &, Expression *a, Expression *b) {  // x+0 -> x
+                    return isNumber(b, 0) ? a : nullptr;
+                }},
+                {eta, [](Simplifier &, Expression *a, Expression *b) {  // 0+x -> x
+                    return isNumber(a, 0) ? b : nullptr;
+                }},
+                {ets, [](Simplifier &, Expression *a, Expression *b) {  // x-0 -> x
+                    return isNumber(b, 0) ? a : nullptr;
+                }},
+                {ets, [](Simplifier &self, Expression *a, Expression *b) {  // x-x -> 0
+                    return self.equal(a, b) ? self.number(0) : nullptr;
+                }},
+                {etm, [](Simplifier &self, Expression *a, Expression *b) {  // x*0, 0*x -> 0
+                    return isNumber(a, 0) || isNumber(b, 0) ? self.number(0) : nullptr;
+                }},
+                {etm, [](Simplifier &, Expression *a, Expression *b) {  // x*1 -> x
+                    return isNumber(b, 1) ? a : nullptr;
+                }},
+                {etm, [](Simplifier &, Expression *a, Expression *b) {  // 1*x -> x
+                    return isNumber(a, 1) ? b : nullptr;
+                }},
+                {etd, [](Simplifier &, Expression *a, Expression *b) {  // x/1 -> x
+                    return isNumber(b, 1) ? a : nullptr;
+                }},
+                {etd, [](Simplifier &, Expression *a, Expression *b) {  // 0/x -> 0
+                    return isNumber(a, 0) && !isNumber(b, 0) ? a : nullptr;
+                }},
+        };
+        return r;
+    }
+
+    struct Info {
+        Expression *result;
+        size_t hash;
+        bool has_variable;
+    };
+
+    stack<Expression *> &_allocated;
+    const unordered_map<string, int> *_bindings;  // Known values of variables, may be nullptr
+    unordered_map<Expression *, Info> _info;  // For every visited or created node
+
+    Expression *number(int n) {
+        _allocated.push(new Number{n});
+        return remember(_allocated.top(), nullptr, nullptr);
+    }
+
+    Expression *remember(Expression *e, Expression *first, Expression *second) {  // Children are remembered
+        ExpressionType type = e->getType();
+        Info info{e, hash<int>{}(type), type == etv};
+        size_t &h = info.hash;
+        if (type == etn) {
+            h ^= hash<int>{}(((Number *) e)->getN()) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        } else if (type == etv) {
+            h ^= hash<string>{}(((Variable *) e)->getS()) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        } else {
+            const Info &a = _info[first], &b = _info[second];
+            info.has_variable = a.has_variable || b.has_variable;
+            h ^= a.hash + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+            h ^= b.hash + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        }
+        _info[e] = info;
+        return e;
+    }
+
+    Expression *fold(ExpressionType type, int a, int b) {  // nullptr if the result is undefined or overflows
+        int r;
+        switch (type) {
+            case eta: return __builtin_add_overflow(a, b, &r) ? nullptr : number(r);
+            case ets: return __builtin_sub_overflow(a, b, &r) ? nullptr : number(r);
+            case etm: return __builtin_mul_overflow(a, b, &r) ? nullptr : number(r);
+            default:
+                try {
+                    return number(Domain<int>::divide(a, b));
+                } catch (const domain_error &) {
+                    return nullptr;
+                }
+        }
+    }
+
+    Expression *rewrite(Expression *e, Expression *first, Expression *second) {  // Children are simplified
+        ExpressionType type = e->getType();
+        if (first->getType() == etn && second->getType() == etn) {
+            Expression *folded = fold(type, ((Number *) first)->getN(), ((Number *) second)->getN());
+            if (folded) return folded;
+        }
+        for (const Rule &rule: rules()) {
+            if (rule.type != type) continue;
+            Expression *replacement = rule.apply(*this, first, second);
+            if (replacement) return replacement;  // Rules only return simplified nodes
+        }
+        if (first == children(e).first && second == children(e).second) return remember(e, first, second);
+        _allocated.push(make_operation(operation_symbols[type], first, second));
+        return remember(_allocated.top(), first, second);
+    }
+
+public:
+    explicit Simplifier(stack<Expression *> &allocated, const unordered_map<string, int> *bindings = nullptr) :
+            _allocated(allocated), _bindings(bindings) {}
+
+    bool hasVariable(Expression *e) {
+        return _info[simplify(e)].has_variable;
+    }
+
+    bool equal(Expression *a, Expression *b) {  // Structural equality of remembered nodes
+        stack<pair<Expression *, Expression *>> st;
+        st.emplace(a, b);
+        while (!st.empty()) {
+            auto [x, y] = st.top();
+            st.pop();
+            if (x == y) continue;
+            if (_info[x].hash != _info[y].hash || x->getType() != y->getType()) return false;
+            if (x->getType() == etn) {
+                if (((Number *) x)->getN() != ((Number *) y)->getN()) return false;
+            } else if (x->getType() == etv) {
+                if (((Variable *) x)->getS() != ((Variable *) y)->getS()) return false;
+            } else {
+                st.emplace(children(x).first, children(y).first);
+                st.emplace(children(x).second, children(y).second);
+            }
+        }
+        return true;
+    }
+
+    // One pass is enough: a node is rewritten after its children, and a rule or a fold only returns nodes that are
+    // already simplified, so the result has nothing left to rewrite
+    Expression *simplify(Expression *root) {
+        stack<pair<Expression *, bool>> st;  // <node, children are already simplified>
+        st.emplace(root, false);
+        while (!st.empty()) {
+            auto [e, ready] = st.top();
+            st.pop();
+            if (_info.count(e)) continue;
+            auto [first, second] = children(e);
+            if (!first) {
+                remember(e, nullptr, nullptr);
+                if (_bindings && e->getType() == etv) {
+                    auto it = _bindings->find(((Variable *) e)->getS());
+                    if (it != _bindings->end()) {
+                        Expression *n = number(it->second);
+                        _info[e].result = n;
+                    }
+                }
+            } else if (!ready) {
+                st.emplace(e, true);
+                st.emplace(second, false);
+                st.emplace(first, false);
+            } else {
+                Expression *result = rewrite(e, _info[first].result, _info[second].result);
+                if (result != e) _info[e] = Info{result, 0, false};  // Only result is used for replaced nodes
+            }
+        }
+        return _info[root].result;
+    }
+};
+
 Expression *simplify(Expression *e, stack<Expression *> &allocated) {  // Additional task 2
-    ExpressionType type = e->getType();
-    if (!e->isVarInExp()) {  // Additional task 2.a
-        if (type == etn) return e;
-        allocated.push(new Number{e->eval("")});
-        return allocated.top();
-    }
-    if (type == etm) {
-        Mul *me = (Mul *) e;
-        // Additional task 2.c
-        Expression *exp = me->getFirst();
-        if (exp->getType() == etn && exp->eval("") == 0) {
-            allocated.push(new Number{0});
-            return allocated.top();
-        }
-        exp = me->getSecond();
-        if (exp->getType() == etn && exp->eval("") == 0) {
-            allocated.push(new Number{0});
-            return allocated.top();
-        }
-        // Additional task 2.d
-        if (exp->getType() == etn && exp->eval("") == 1) return me->getFirst();
-        exp = me->getFirst();
-        if (exp->getType() == etn && exp->eval("") == 1) return me->getSecond();
-        // Else
-        allocated.push(new Mul{simplify(me->getFirst(), allocated),
-                               simplify(me->getSecond(), allocated)});
-    } else if (type == ets) {
-        Sub *se = (Sub *) e;
-        if (se->getFirst()->toString() == se->getSecond()->toString()) {
-            allocated.push(new Number{0});
-            return allocated.top();
-        }
-        // Else
-        allocated.push(new Sub{simplify(se->getFirst(), allocated),
-                               simplify(se->getSecond(), allocated)});
-    } else if (type == etn) {
-        auto *ne = (Number *) e;
-        allocated.push(new Number{ne->getN()});
-    } else if (type == etv) {
-        auto *ve = (Variable *) e;
-        allocated.push(new Variable{ve->getS()});
-    } else if (type == eta) {
-        auto *ae = (Add *) e;
-        allocated.push(new Add(simplify(ae->getFirst(), allocated),
-                               simplify(ae->getSecond(), allocated)));
-    } else {  // Div
-        auto *de = (Div *) e;
-        allocated.push(new Div{simplify(de->getFirst(), allocated),
-                               simplify(de->getSecond(), allocated)});
-    }
-    return allocated.top();
-}
-
-int main() {
+    return Simplifier{allocated}.simplify(e);
+}
+
+// Substitutes known variables, folds constants and applies the rules in the same pass
+Expression *specialize(Expression *e, const unordered_map<string, int> &bindings, stack<Expression *> &allocated) {
+    return Simplifier{allocated, &bindings}.simplify(e);
+}
+
+void benchmark_parser() {  // Time per byte should stay flat as the input grows
+    for (size_t size = 1 << 19; size <= (1 << 21); size *= 2) {
+        string nested, chain;  // ((...(x+1)*2...)+1) and x+1*x+1*x...
+        size_t depth = size / 4;
+        nested.append(depth, '(');
+        nested += 'x';
+        for (size_t i = 0; i < depth; ++i) nested += (i % 2 ? "*2)" : "+1)");
+        chain += 'x';
+        while (chain.size() < size) chain += "+1*x";
+        for (const string *input: {&nested, &chain}) {
+            stack<Expression *> allocated;
+            auto start = chrono::steady_clock::now();
+            parse_expression(*input, allocated);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << (input == &nested ? "nested " : "chain  ") << input->size() << " bytes: " << ms << " ms, "
+                 << ms * 1e6 / double(input->size()) << " ns/byte" << endl;
+            deallocating(allocated);
+        }
+    }
+}
+
+void stress_deep(size_t depth = 1000000) {  // Every operation on a tree of the given depth
+    // No Mul and Div: their derivatives share the original subtrees, so walking f' would be quadratic
+    string nested(depth, '(');
+    nested += 'x';
+    for (size_t i = 0; i < depth; ++i) nested += (i % 2 ? "-1)" : "+x)");
+    stack<Expression *> allocated;
+    auto start = chrono::steady_clock::now();
+    auto step = [&start](const string &name) {
+        auto now = chrono::steady_clock::now();
+        cout << name << ": " << chrono::duration<double, milli>(now - start).count() << " ms" << endl;
+        start = now;
+    };
+    Expression *e = parse_expression(nested, allocated);
+    step("parse");
+    cout << "f(1) = " << e->eval("x := 1;") << endl;
+    step("eval");
+    Expression *de = e->derivative("x");
+    step("derivative");
+    cout << "f'(1) = " << de->eval("x := 1;") << endl;
+    step("eval derivative");
+    cout << "length of f' = " << de->toString().size() << endl;
+    step("toString");
+    cout << "x in f' = " << de->isVarInExp() << endl;
+    step("isVarInExp");
+    cout << "length of simplified f' = " << simplify(de, allocated)->toString().size() << endl;
+    step("simplify");
+    deallocating(allocated);
+    step("destruction");
+}
+
+void benchmark_print() {  // Time per node should stay flat as the derivative grows
+    int fd = open("/dev/null", O_WRONLY);
+    for (size_t n = 1 << 20; n <= (1 << 22); n *= 2) {
+        string chain = "x";
+        for (size_t i = 0; i < n; ++i) chain += "+x";
+        stack<Expression *> allocated;
+        Expression *de = parse_expression(chain, allocated)->derivative("x");
+        auto start = chrono::steady_clock::now();
+        write_expression(de, fd);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << 2 * n + 1 << " nodes: " << ms << " ms, " << ms * 1e6 / double(2 * n + 1) << " ns/node" << endl;
+        deallocating(allocated);
+    }
+    close(fd);
+}
+
+struct Instruction {  // 12 bytes instead of a heap object with a vtable and a stack
+    ExpressionType type;
+    int32_t first;  // Index of the first operand, value of Number or index of Variable
+    int32_t second;  // Index of the second operand
+};
+
+// Expression in post-order: operands always precede their instruction, the root is the last, shared subtrees are
+// emitted once. Interpretation, derivatives, gradients and the JIT all work on this one layout
+struct Program {
+    vector<Instruction> code;
+    vector<string> variables;  // Order of arguments
+    unordered_map<string, int32_t> variable_index;
+
+    int32_t number(int n) {
+        code.push_back({etn, n, 0});
+        return int32_t(code.size() - 1);
+    }
+
+    int32_t variable(const string &name) {
+        auto it = variable_index.find(name);
+        if (it == variable_index.end()) {
+            it = variable_index.emplace(name, int32_t(variables.size())).first;
+            variables.push_back(name);
+        }
+        code.push_back({etv, it->second, 0});
+        return int32_t(code.size() - 1);
+    }
+
+    int32_t operation(ExpressionType type, int32_t first, int32_t second) {
+        code.push_back({type, first, second});
+        return int32_t(code.size() - 1);
+    }
+
+    [[nodiscard]] size_t getSize() const { return code.size(); }
+
+    [[nodiscard]] size_t bytes() const { return code.capacity() * sizeof(Instruction); }
+
+    template<typename T>
+    [[nodiscard]] T evalAs(const T *values) const {  // int, int64_t, double or Interval, values by variable index
+        vector<T> t(code.size());
+        for (size_t i = 0; i < code.size(); ++i) {
+            const Instruction &in = code[i];
+            switch (in.type) {
+                case etn: t[i] = T(in.first); break;
+                case etv: t[i] = values[in.first]; break;
+                case eta: t[i] = t[in.first] + t[in.second]; break;
+                case ets: t[i] = t[in.first] - t[in.second]; break;
+                case etm: t[i] = t[in.first] * t[in.second]; break;
+                case etd: t[i] = Domain<T>::divide(t[in.first], t[in.second]); break;
+            }
+        }
+        return t.back();
+    }
+
+    template<typename T>
+    [[nodiscard]] T evalAs(const vector<T> &values) const { return evalAs<T>(values.data()); }
+
+    [[nodiscard]] int run(const int *values) const { return evalAs<int>(values); }  // Used when there is no compiler
+
+    [[nodiscard]] int eval(string s) const {  // Same input as Expression::eval
+        vector<int> values;
+        for (string name: variables) values.push_back(extract_var_from_string(s, name));
+        return run(values.data());
+    }
+
+    [[nodiscard]] Program derivative(const string &s) const {  // Appended after the original instructions
+        Program p = *this;
+        vector<int32_t> d(code.size());
+        for (size_t i = 0; i < code.size(); ++i) {
+            Instruction in = code[i];
+            int32_t f = in.first, g = in.second;
+            switch (in.type) {
+                case etn: d[i] = p.number(0); break;
+                case etv: d[i] = p.number(variables[f] == s ? 1 : 0); break;
+                case eta: d[i] = p.operation(eta, d[f], d[g]); break;
+                case ets: d[i] = p.operation(ets, d[f], d[g]); break;
+                case etm: d[i] = p.operation(eta, p.operation(etm, d[f], g), p.operation(etm, f, d[g])); break;
+                case etd:
+                    d[i] = p.operation(etd, p.operation(ets, p.operation(etm, d[f], g), p.operation(etm, f, d[g])),
+                                       p.operation(etm, g, g));
+                    break;
+            }
+        }
+        return p;  // Outer instructions are created last, so the derivative of the root is the last one
+    }
+
+    [[nodiscard]] string toString() const {
+        string out;
+        vector<pair<int32_t, char>> st{{int32_t(code.size() - 1), 0}};  // Instruction or, if it is -1, a char
+        while (!st.empty()) {
+            auto [i, c] = st.back();
+            st.pop_back();
+            if (i < 0) {
+                out += c;
+                continue;
+            }
+            const Instruction &in = code[i];
+            if (in.type == etn) append_number(out, in.first);
+            else if (in.type == etv) out += variables[in.first];
+            else {
+                st.emplace_back(-1, ')');
+                st.emplace_back(in.second, 0);
+                st.emplace_back(-1, operation_symbols[in.type]);
+                st.emplace_back(in.first, 0);
+                st.emplace_back(-1, '(');
+            }
+        }
+        return out;
+    }
+
+    [[nodiscard]] string toC() const {
+        string src = "int expr_eval(const int *v, int *fault) {\n";  // *fault is set instead of trapping
+        for (size_t i = 0; i < code.size(); ++i) {
+            const Instruction &in = code[i];
+            src += "    int t" + to_string(i) + " = ";
+            if (in.type == etn) src += to_string(in.first);
+            else if (in.type == etv) src += "v[" + to_string(in.first) + "]";
+            else if (in.type == etd) {
+                string a = "t" + to_string(in.first), b = "t" + to_string(in.second);
+                src += b + " == 0 || (" + b + " == -1 && " + a + " == -2147483647 - 1) ? (*fault = 1, 0) : " + a +
+                       " / " + b;
+            } else {
+                src += "t" + to_string(in.first) + " " + operation_symbols[in.type] + " t" + to_string(in.second);
+            }
+            src += ";\n";
+        }
+        return src + "    return t" + to_string(code.size() - 1) + ";\n}\n";
+    }
+};
+
+Program lower(Expression *root) {  // Shared subtrees stay shared
+    Program p;
+    unordered_map<Expression *, int32_t> index;  // Node -> instruction
+    vector<pair<Expression *, bool>> st{{root, false}};  // <node, children are already lowered>
+    while (!st.empty()) {
+        auto [e, ready] = st.back();
+        st.pop_back();
+        if (index.count(e)) continue;
+        auto [first, second] = children(e);
+        if (first && !ready) {
+            st.emplace_back(e, true);
+            st.emplace_back(second, false);
+            st.emplace_back(first, false);
+        } else if (first) {
+            index[e] = p.operation(e->getType(), index[first], index[second]);
+        } else {
+            index[e] = e->getType() == etn ? p.number(((Number *) e)->getN()) : p.variable(((Variable *) e)->getS());
+        }
+    }
+    return p;
+}
+
+using NativeFunction = int (*)(const int *values, int *fault);
+
+class CompiledExpression {
+private:
+    Program _program;
+    NativeFunction _f;  // nullptr if the program is interpreted
+
+public:
+    CompiledExpression(Program program, NativeFunction f) : _program(std::move(program)), _f(f) {}
+
+    [[nodiscard]] const vector<string> &getVariables() const { return _program.variables; }
+
+    [[nodiscard]] bool isNative() const { return _f != nullptr; }
+
+    [[nodiscard]] int eval(const vector<int> &values) const {  // values in order of getVariables()
+        int fault = 0;
+        int result = _f ? _f(values.data(), &fault) : _program.run(values.data());
+        return fault ? _program.run(values.data()) : result;  // The interpreter throws the domain_error
+    }
+};
+
+class JitCompiler {  // Compiles with $CC (cc by default) and dlopen()s the result; link with -ldl on old glibc
+private:
+    unordered_map<string, NativeFunction> _cache;  // C source -> compiled function
+    vector<void *> _handles;
+    bool _compiler_available = true;
+
+    NativeFunction build(const string &src) {
+        char dir[] = "/tmp/expr_jit_XXXXXX";
+        if (!mkdtemp(dir)) return nullptr;
+        string c_path = string{dir} + "/expr.c", so_path = string{dir} + "/expr.so";
+        ofstream{c_path} << src;
+        const char *cc = getenv("CC");
+        string command = string{cc ? cc : "cc"} + " -O3 -shared -fPIC -o " + so_path + " " + c_path +
+                         " > /dev/null 2>&1";
+        void *handle = system(command.c_str()) == 0 ? dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL) : nullptr;
+        remove(c_path.c_str());
+        remove(so_path.c_str());  // The mapping stays valid after unlinking
+        rmdir(dir);
+        if (!handle) {
+            _compiler_available = false;
+            return nullptr;
+        }
+        _handles.push_back(handle);
+        return (NativeFunction) dlsym(handle, "expr_eval");
+    }
+
+public:
+    JitCompiler() = default;
+
+    JitCompiler(const JitCompiler &) = delete;
+
+    JitCompiler &operator=(const JitCompiler &) = delete;
+
+    ~JitCompiler() {
+        for (void *handle: _handles) dlclose(handle);
+    }
+
+    CompiledExpression compile(Expression *e) {
+        Program p = lower(e);
+        if (!_compiler_available) return {std::move(p), nullptr};
+        string src = p.toC();
+        auto it = _cache.find(src);
+        if (it != _cache.end()) return {std::move(p), it->second};
+        NativeFunction f = build(src);
+        if (f) _cache.emplace(std::move(src), f);
+        return {std::move(p), f};
+    }
+};
+
+struct Dual {  // value + derivative * eps, eps * eps = 0
+    double value, derivative;
+
+    Dual operator+(const Dual &o) const { return {value + o.value, derivative + o.derivative}; }
+
+    Dual operator-(const Dual &o) const { return {value - o.value, derivative - o.derivative}; }
+
+    Dual operator*(const Dual &o) const { return {value * o.value, derivative * o.value + value * o.derivative}; }
+
+    Dual operator/(const Dual &o) const {
+        return {value / o.value, (derivative * o.value - value * o.derivative) / (o.value * o.value)};
+    }
+};
+
+// Forward mode: derivative along direction, values and direction in order of p.variables
+Dual directional_derivative(const Program &p, const vector<double> &values, const vector<double> &direction) {
+    vector<Dual> t(p.code.size());
+    for (size_t i = 0; i < p.code.size(); ++i) {
+        const Instruction &in = p.code[i];
+        switch (in.type) {
+            case etn: t[i] = {double(in.first), 0}; break;
+            case etv: t[i] = {values[in.first], direction[in.first]}; break;
+            case eta: t[i] = t[in.first] + t[in.second]; break;
+            case ets: t[i] = t[in.first] - t[in.second]; break;
+            case etm: t[i] = t[in.first] * t[in.second]; break;
+            case etd: t[i] = t[in.first] / t[in.second]; break;
+        }
+    }
+    return t.back();
+}
+
+// Reverse mode: one forward and one backward sweep give the derivatives by all variables
+vector<double> gradient(const Program &p, const vector<double> &values) {
+    size_t n = p.code.size();
+    vector<double> t(n), adjoint(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        const Instruction &in = p.code[i];
+        switch (in.type) {
+            case etn: t[i] = in.first; break;
+            case etv: t[i] = values[in.first]; break;
+            case eta: t[i] = t[in.first] + t[in.second]; break;
+            case ets: t[i] = t[in.first] - t[in.second]; break;
+            case etm: t[i] = t[in.first] * t[in.second]; break;
+            case etd: t[i] = t[in.first] / t[in.second]; break;
+        }
+    }
+    vector<double> result(p.variables.size(), 0);
+    adjoint[n - 1] = 1;
+    for (size_t i = n; i-- > 0;) {
+        const Instruction &in = p.code[i];
+        double a = adjoint[i];
+        switch (in.type) {
+            case etn: break;
+            case etv: result[in.first] += a; break;
+            case eta: adjoint[in.first] += a; adjoint[in.second] += a; break;
+            case ets: adjoint[in.first] += a; adjoint[in.second] -= a; break;
+            case etm:
+                adjoint[in.first] += a * t[in.second];
+                adjoint[in.second] += a * t[in.first];
+                break;
+            case etd:
+                adjoint[in.first] += a / t[in.second];
+                adjoint[in.second] -= a * t[in.first] / (t[in.second] * t[in.second]);
+                break;
+        }
+    }
+    return result;
+}
+
+unordered_map<string, double> gradient(Expression *e, const unordered_map<string, double> &point) {
+    Program p = lower(e);
+    vector<double> values;
+    for (const string &v: p.variables) values.push_back(point.at(v));
+    vector<double> g = gradient(p, values);
+    unordered_map<string, double> result;
+    for (size_t i = 0; i < g.size(); ++i) result[p.variables[i]] = g[i];
+    return result;
+}
+
+template<typename T>
+bool parse_bindings(int argc, char *argv[], unordered_map<string, T> &bindings) {  // name=value from argv[2] on
+    for (int i = 2; i < argc; ++i) {
+        string_view arg = argv[i];
+        size_t eq = arg.find('=');
+        T value{};
+        from_chars_result parsed{arg.data(), errc::invalid_argument};  // A binding without a name or = is bad too
+        if (eq != string_view::npos && eq > 0) parsed = from_chars(arg.data() + eq + 1, arg.data() + arg.size(), value);
+        if (parsed.ec != errc{} || parsed.ptr != arg.data() + arg.size()) {
+            cerr << "bad binding " << arg << ", expected name=number" << endl;
+            return false;
+        }
+        bindings[string(arg.substr(0, eq))] = value;
+    }
+    return true;
+}
+
+int gradient_task(int argc, char *argv[]) {  // Expression from cin, point as x=1 y=2 in arguments
+    unordered_map<string, double> point;
+    if (!parse_bindings(argc, argv, point)) return 1;
     stack<Expression *> allocated;
     string s;
-    cin >> s;
-    s = adding_brackets(s);  // Additional task 1
+    getline(cin, s);
+    try {
+        Program p = lower(parse_expression(s, allocated));
+        vector<double> values;
+        for (const string &v: p.variables) values.push_back(point.count(v) ? point[v] : 0);
+        vector<double> g = gradient(p, values);
+        for (size_t i = 0; i < g.size(); ++i) cout << "d/d" << p.variables[i] << " = " << g[i] << endl;
+    } catch (const ParseError &error) {
+        cerr << error.what() << endl;
+    }
+    deallocating(allocated);
+    return 0;
+}
+
+void benchmark_compact() {  // Virtual hierarchy against a lowered Program on the same formula
+    const char *parts[] = {"+x", "*1", "-1", "/1"};
+    string formula = "x";
+    for (int i = 0; i < 1000000; ++i) formula += parts[i % 4];
+    stack<Expression *> allocated;
+    size_t heap_before = mallinfo2().uordblks;
+    Expression *e = parse_expression(formula, allocated);
+    size_t heap_after = mallinfo2().uordblks;
+    Program c = lower(e);
+    cout << "nodes: " << c.getSize() << endl;
+    cout << "bytes per node: virtual " << double(heap_after - heap_before) / double(allocated.size())
+         << ", compact " << double(c.bytes()) / double(c.getSize()) << endl;
+    auto time = [](const auto &f) {
+        auto start = chrono::steady_clock::now();
+        f();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+    int r1 = 0, r2 = 0;
+    double t1 = time([&] { r1 = e->eval("x := 3;"); }), t2 = time([&] { r2 = c.eval("x := 3;"); });
+    cout << "eval: virtual " << t1 << " ms, compact " << t2 << " ms" << (r1 == r2 ? "" : ", results differ") << endl;
+    Expression *de = nullptr;
+    Program dc;
+    t1 = time([&] { de = e->derivative("x"); });
+    t2 = time([&] { dc = c.derivative("x"); });
+    cout << "derivative: virtual " << t1 << " ms, compact " << t2 << " ms" << endl;
+    t1 = time([&] { r1 = de->eval("x := 3;"); });
+    t2 = time([&] { r2 = dc.eval("x := 3;"); });
+    cout << "eval derivative: virtual " << t1 << " ms, compact " << t2 << " ms"
+         << (r1 == r2 ? "" : ", results differ") << endl;
+    deallocating(allocated);
+}
+
+int specialize_task(int argc, char *argv[]) {  // Expression from cin, known variables as a=1 b=2 in arguments
+    unordered_map<string, int> bindings;
+    if (!parse_bindings(argc, argv, bindings)) return 1;
+    stack<Expression *> allocated;
+    string s;
+    getline(cin, s);
+    try {
+        specialize(parse_expression(s, allocated), bindings, allocated)->print();
+    } catch (const ParseError &error) {
+        cerr << error.what() << endl;
+    }
+    deallocating(allocated);
+    return 0;
+}
+
+void benchmark_specialize() {  // Sweep over x of a model with fixed parameters a..d
+    stack<Expression *> allocated;
+    string model = "x";
+    for (int i = 0; i < 20000; ++i) model += "+(a*x-b)*(c+d*0)/(a+1)-x*(b-b)";
+    Expression *e = parse_expression(model, allocated);
+    unordered_map<string, int> bindings{{"a", 2}, {"b", 3}, {"c", 5}, {"d", 7}};
+    Expression *r = specialize(e, bindings, allocated);
+    Program full = lower(e), residual = lower(r);
+    cout << "nodes: " << full.getSize() << " -> " << residual.getSize() << endl;
+    vector<int> full_values, residual_values(residual.variables.size());
+    for (const string &name: full.variables) full_values.push_back(name == "x" ? 0 : bindings[name]);
+    long long check_full = 0, check_residual = 0;
+    auto start = chrono::steady_clock::now();
+    for (int x = 0; x < 1000; ++x) {
+        for (size_t i = 0; i < full_values.size(); ++i) if (full.variables[i] == "x") full_values[i] = x;
+        check_full += full.run(full_values.data());
+    }
+    double full_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (int x = 0; x < 1000; ++x) {
+        fill(residual_values.begin(), residual_values.end(), x);  // Only x is left
+        check_residual += residual.run(residual_values.data());
+    }
+    double residual_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "sweep: full " << full_ms << " ms, specialized " << residual_ms << " ms, results "
+         << (check_full == check_residual ? "match" : "differ") << endl;
+    deallocating(allocated);
+}
 
-    Expression *e = extract_expression(s, allocated);
+void benchmark_interval() {  // Maximum over a grid, boxes whose upper bound cannot win are skipped
+    stack<Expression *> allocated;
+    Expression *e = parse_expression("x*(100000-x)/(x+1000)-(x-30000)*(x-30000)/50000", allocated);
+    Program c = lower(e);
+    const int n = 1000000, box = 1000;
+    auto start = chrono::steady_clock::now();
+    double best = -numeric_limits<double>::infinity();
+    for (int x = 0; x < n; ++x) best = max(best, c.evalAs<double>({double(x)}));
+    double all_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    double pruned_best = -numeric_limits<double>::infinity();
+    int evaluated = 0;
+    for (int lo = 0; lo < n; lo += box) {
+        if (c.evalAs<Interval>({Interval(lo, lo + box - 1)}).hi <= pruned_best) continue;
+        for (int x = lo; x < lo + box; ++x, ++evaluated) pruned_best = max(pruned_best, c.evalAs<double>({double(x)}));
+    }
+    double pruned_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "max " << best << " in " << all_ms << " ms; with interval pruning max " << pruned_best << " in "
+         << pruned_ms << " ms, " << evaluated << " of " << n << " points evaluated" << endl;
+    try {
+        evaluate_as<int64_t>(e, {{"x", -1000}});
+    } catch (const domain_error &error) {
+        cout << "int64_t at x = -1000: " << error.what() << endl;
+    }
+    deallocating(allocated);
+}
+
+void benchmark_jit() {  // Tree interpretation against native code on the same points
+    stack<Expression *> allocated;
+    Expression *e = parse_expression("(x*x*x-2*x*y+y*y*3)/(x+y+1)-(x-y)*(x+y)", allocated);
     Expression *de = e->derivative("x");
-    de->print();
-    // simplify(e, allocated)->print();  // 2*0+x*2-3 -> ((0+(x*2))-3)
+    JitCompiler jit;
+    CompiledExpression compiled = jit.compile(de);
+    cout << (compiled.isNative() ? "native" : "interpreted (no compiler)") << endl;
+    const int points = 100000;
+    long long check_tree = 0, check_compiled = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < points; ++i)
+        check_tree += de->eval("x := " + to_string(i % 100) + "; y := " + to_string(i % 7) + ";");
+    double tree_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    vector<int> values(compiled.getVariables().size());
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < points; ++i) {
+        for (size_t j = 0; j < values.size(); ++j) values[j] = compiled.getVariables()[j] == "x" ? i % 100 : i % 7;
+        check_compiled += compiled.eval(values);
+    }
+    double compiled_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "tree: " << tree_ms << " ms, compiled: " << compiled_ms << " ms, results "
+         << (check_tree == check_compiled ? "match" : "differ") << endl;
+    deallocating(allocated);
+}
+
+void benchmark_derivative_cache() {  // Allocations for the nth derivative of x*x*...*x
+    const int factors = 8;
+    string product = "x";
+    for (int i = 1; i < factors; ++i) product += "*x";
+    for (int n = 1; n <= 6; ++n) {
+        size_t allocations[2];
+        int values[2];
+        for (int cached = 0; cached < 2; ++cached) {
+            NodeArena arena;
+            NodeArena::current = &arena;
+            {
+                stack<Expression *> allocated;
+                Expression *e = parse_expression(product, allocated);
+                size_t before = arena.getAllocations();
+                DerivativeCache cache;
+                for (int i = 0; i < n; ++i) e = cached ? cache.derivative(e, "x") : e->derivative("x");
+                allocations[cached] = arena.getAllocations() - before;
+                int x = 2;
+                values[cached] = lower(e).run(&x);  // Shared subtrees are evaluated once
+                deallocating(allocated);
+            }
+            NodeArena::current = nullptr;
+        }
+        cout << "derivative " << n << ": " << allocations[0] << " nodes without cache, " << allocations[1]
+             << " with cache" << (values[0] == values[1] ? "" : ", results differ") << endl;
+    }
+}
+
+string process_formula(string_view formula, stack<Expression *> &allocated) {  // One line of the batch
+    try {
+        Expression *e, *de, *se;
+        {
+            STATS_PHASE(sp_parse);
+            e = parse_expression(formula, allocated);
+        }
+        STATS_TREE("input", e);
+        {
+            STATS_PHASE(sp_derivative);
+            de = e->derivative("x");
+        }
+        STATS_TREE("derivative", de);
+        {
+            STATS_PHASE(sp_simplify);
+            se = simplify(de, allocated);
+        }
+        STATS_TREE("simplified", se);
+        STATS_PHASE(sp_print);
+        ExpressionWriter writer;
+        writer.write(se);
+        return writer.take();
+    } catch (const ParseError &error) {
+        return string{"error: "} + error.what();
+    }
+}
+
+void batch_task(const string &path, unsigned threads) {  // Results are written in the order of the input lines
+    threads = max(threads, 1u);  // Without a worker the output would be waited for forever
+    ifstream in{path, ios::binary};
+    if (!in) {
+        cerr << "cannot open " << path << endl;
+        return;
+    }
+    string text{istreambuf_iterator<char>{in}, istreambuf_iterator<char>{}};
+    vector<string_view> lines;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        if (end == string::npos) end = text.size();
+        lines.emplace_back(text.data() + start, end - start);
+        start = end + 1;
+    }
+    const size_t block_lines = 64;
+    size_t blocks = (lines.size() + block_lines - 1) / block_lines;
+    vector<string> output(blocks);
+    vector<char> done(blocks, false);
+    atomic<size_t> next_block{0};
+    mutex m;
+    condition_variable cv;
+    vector<thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&]() {
+            NodeArena arena;
+            NodeArena::current = &arena;
+            for (size_t b; (b = next_block++) < blocks;) {
+                string result;
+                for (size_t i = b * block_lines; i < min(lines.size(), (b + 1) * block_lines); ++i) {
+                    stack<Expression *> allocated;
+                    result += process_formula(lines[i], allocated);
+                    result += '\n';
+                    deallocating(allocated);
+                    arena.reset();
+                }
+                lock_guard<mutex> lock{m};
+                output[b] = std::move(result);
+                done[b] = true;
+                cv.notify_all();
+            }
+            NodeArena::current = nullptr;
+        });
+    }
+    for (size_t b = 0; b < blocks; ++b) {
+        string result;
+        {
+            unique_lock<mutex> lock{m};
+            cv.wait(lock, [&]() { return done[b]; });
+            result = std::move(output[b]);
+        }
+        cout.write(result.data(), streamsize(result.size()));
+    }
+    for (thread &t: pool) t.join();
+    cout.flush();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && string{argv[1]} == "--bench-parser") {
+        benchmark_parser();
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--stress") {
+        stress_deep();
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--bench-print") {
+        benchmark_print();
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--gradient") return gradient_task(argc, argv);
+    if (argc > 2 && string{argv[1]} == "--batch") {
+        unsigned threads = max(1u, thread::hardware_concurrency());
+        if (argc > 3) {
+            string_view count = argv[3];
+            auto [end, ec] = from_chars(count.data(), count.data() + count.size(), threads);
+            if (ec != errc{} || end != count.data() + count.size() || threads < 1) {
+                cerr << "bad thread count " << count << ", expected a positive number" << endl;
+                return 1;
+            }
+        }
+        batch_task(argv[2], threads);
+        STATS_JSON(cerr);
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--bench-derivative-cache") {
+        benchmark_derivative_cache();
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--specialize") return specialize_task(argc, argv);
+    if (argc > 1 && string{argv[1]} == "--bench-specialize") {
+        benchmark_specialize();
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--bench-interval") {
+        benchmark_interval();
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--bench-compact") {
+        benchmark_compact();
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--bench-jit") {
+        benchmark_jit();
+        return 0;
+    }
+    bool stats = argc > 1 && string{argv[1]} == "--stats";  // JSON to cerr, needs -DEXPR_STATS
+#ifndef EXPR_STATS
+    if (stats) cerr << "--stats: statistics are not collected, compile with -DEXPR_STATS" << endl;
+#endif
+    stack<Expression *> allocated;
+    string s;
+    getline(cin, s);
+
+    Expression *e;
+    try {
+        STATS_PHASE(sp_parse);
+        e = parse_expression(s, allocated);  // Brackets are optional, so adding_brackets is not needed
+    } catch (const ParseError &error) {
+        cerr << error.what() << endl;
+        deallocating(allocated);
+        return 1;
+    }
+    STATS_TREE("input", e);
+    Expression *de, *se;
+    {
+        STATS_PHASE(sp_derivative);
+        de = e->derivative("x");
+    }
+    STATS_TREE("derivative", de);
+    {
+        STATS_PHASE(sp_simplify);
+        se = simplify(de, allocated);
+    }
+    STATS_TREE("simplified", se);
+    {
+        STATS_PHASE(sp_print);
+        se->print();  // (1+2)*x-3/y -> 3
+    }
 
     deallocating(allocated);
+    if (stats) STATS_JSON(cerr);
     return 0;
 }
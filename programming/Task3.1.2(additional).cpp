@@ -5,291 +5,102 @@
  * Additional task 2
  */
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
-using namespace std;
-
-template<typename T>
-class Vector {
-    static const int default_size = 8;
-
-    int size;
-    int memory;
-    T *arr;
-
-    void resize() {
-        int past_memory = memory;
-        memory *= 2;
-        size = 0;
-        T *arr2 = new T[memory];
-        for (int i = 0; i < memory; ++i)
-            arr2[i] = T{};
-        swap(arr, arr2);
-        for (int i = 0; i < past_memory; ++i)
-            add(arr2[i]);
-        delete[] arr2;
-    }
-
-public:
-    explicit Vector(const int n = 0, const T default_value = T{}) {
-        memory = default_size;
-        size = n;
-        arr = new T[memory];
-        for (int i = 0; i < memory; ++i)
-            arr[i] = default_value;
-    }
-
-    ~Vector() { delete[] arr; }
+#include "Heap.h"
+#include "MultiHashMap.h"
 
-    void add(const T e) {
-        if (size + 1 >= memory) resize();
-        arr[size++] = e;
-    }
-
-    [[nodiscard]] int getSize() const { return size; }
+using namespace std;
 
-    T &operator[](int i) {
-        return arr[i % size];
-    }
 
-    bool operator==(const Vector &other) const {
-        if (size == other.size) {
-            for (int i = 0; i < size; ++i) {
-                if (arr[i] != other.arr[i]) return false;
-            }
-            return true;
+void benchmark() {  // Skewed keys: a few keys get most of the values, most keys get one or two
+    const int n = 1000000, keys = 1000000;
+    size_t heap_before = heap_in_use();
+    auto start = chrono::steady_clock::now();
+    {
+        MultiHashMap<int, string> map;
+        unsigned x = 2463534242u;
+        for (int i = 0; i < n; ++i) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            double u = (x >> 8) / 16777216.0;
+            map.add(int(keys * u * u), to_string(x >> 12));
         }
-        return false;
-    }
-
-    void print(char end='\n') const {
-        cout << '[';
-        for (int i = 0; i + 1 < size; ++i)
-            cout << arr[i] << ' ';
-        if (size > 0) cout << arr[size - 1] << "]" << end;
-    }
-
-    [[nodiscard]] bool in(const T &e) const {
-        for (int i = 0; i < size; ++i)
-            if (arr[i] == e) return true;
-        return false;
-    }
-};
-
-template<typename T>
-class MyIterator : public iterator<input_iterator_tag, T> {
-    T **p;
-
-public:
-    explicit MyIterator(T **p) : p(p) {}
-
-    MyIterator(const MyIterator &it) : p(it.p) {}
-
-    bool operator!=(MyIterator const &other) const { return p != other.p; }
-
-    bool operator==(MyIterator const &other) const { return p == other.p; }
-
-    typename MyIterator::reference operator*() const { return **p; }
-
-    MyIterator &operator++() {
-        while ((*(++p))->null);
-        return *this;
+        double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "add " << s / n * 1e9 << " ns, " << double(heap_in_use() - heap_before) / map.getSize()
+             << " bytes/key, " << map.getSize() << " keys, " << map.getUnique() << " values" << endl;
     }
-};
-
-
-template<typename K, typename V>
-class MultiHashMap {
-    static const int default_size = 8;
-    constexpr static const double rehash_size = 0.3;
-
-    struct Node {
-        K key;
-        Vector<V> *value;
-        bool deleted;
-        bool null;
-
-        explicit Node(const K &k = K{}, const V &v = V{}, const bool &n = true) :
-                key(k), deleted(false), null(n) {
-            value = new Vector<V>;
-            value->add(v);
-        }
-
-        ~Node() { delete value; }
-    };
-
-    Node **arr;
-    int active_size;  // Size without deleted
-    int memory;
-    int general_size;  // Size with deleted
+}
 
-    void resize() {
-        int past_memory = memory;
-        memory *= 2;
-        general_size = 0;
-        active_size = 0;
-        Node **arr2 = new Node *[memory + 1];
-        for (int i = 0; i < memory + 1; ++i)
-            arr2[i] = new Node;
-        arr2[memory]->null = false;
-        swap(arr, arr2);
-        for (int i = 0; i < past_memory; ++i) {
-            Node *t = arr2[i];
-            if (!t->null && !t->deleted) {
-                for (int j = 0; j < t->value->getSize(); ++j)
-                    add(t->key, (*t->value)[j]);
+void benchmark_snapshot(int n) {  // Starting from a snapshot against replaying the adds, for growing sizes
+    const string path = "/tmp/multihashmap_benchmark.snapshot";
+    for (int size = n / 100; size <= n; size *= 10) {
+        auto start = chrono::steady_clock::now();
+        int keys = size / 2;  // Two values per key, every third key is removed before saving
+        {
+            MultiHashMap<int, string> map;
+            for (int i = 0; i < size; ++i)
+                map.add(i % keys, to_string(i));
+            for (int k = 1; k < keys; k += 3)
+                map.remove(k);
+            double build_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            start = chrono::steady_clock::now();
+            if (!map.save(path)) {
+                cout << "cannot write " << path << endl;
+                return;
             }
+            double save_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << size << " values: replay " << build_s * 1e3 << " ms, save " << save_s * 1e3 << " ms";
         }
-        for (int i = 0; i < past_memory + 1; ++i)
-            if (arr2[i])
-                delete arr2[i];
-        delete[] arr2;
-    }
-
-    void rehash() {
-        general_size = 0;
-        active_size = 0;
-        Node **arr2 = new Node *[memory + 1];
-        for (int i = 0; i < memory + 1; ++i)
-            arr2[i] = new Node;
-        arr2[memory]->null = false;
-        swap(arr, arr2);
-        for (int i = 0; i < memory; ++i) {
-            Node *t = arr2[i];
-            if (!t->null && !t->deleted) {
-                for (int j = 0; j < t->value->getSize(); ++j)
-                    add(t->key, (*t->value)[j]);
-            }
+        start = chrono::steady_clock::now();
+        MappedMultiHashMap<int, string> mapped;
+        bool opened = mapped.open(path);
+        MappedValues<string> first = mapped[0];
+        double open_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        bool found = true;
+        for (int i = 0; i < keys; ++i) {
+            int k = int((i * 17LL) % keys);
+            found &= mapped[k].getSize() == (k % 3 == 1 ? 0 : 2);
         }
-        for (int i = 0; i < memory + 1; ++i)
-            if (arr2[i])
-                delete arr2[i];
-        delete[] arr2;
+        double find_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << ", open and first lookup " << open_s * 1e6 << " us, lookups " << keys / find_s / 1e6 << " Mops/s"
+             << (opened && first.getSize() == 2 && first[1] == to_string(keys) && found ? "" : " (lookups failed)")
+             << endl;
     }
+    remove(path.c_str());
+}
 
-public:
-    MultiHashMap() {
-        memory = default_size;
-        active_size = 0;
-        general_size = 0;
-        arr = new Node *[memory + 1];
-        for (int i = 0; i < memory + 1; ++i)
-            arr[i] = new Node;
-        arr[memory]->null = false;
-    }
 
-    ~MultiHashMap() {
-        for (int i = 0; i < memory + 1; ++i)
-            if (arr[i])
-                delete arr[i];
-        delete[] arr;
+int main(int argc, char *argv[]) {
+    if (argc > 1 && string{argv[1]} == "--bench") {
+        benchmark();
+        return 0;
     }
-
-    bool add(const K &k, const V &v) {
-        if (active_size + 1 > int(rehash_size * memory)) resize();
-        else if (general_size > 2 * active_size) rehash();
-        int h = hash<K>{}(k) % memory;
-        int i = 0;
-        int first_deleted = -1;
-        while (!arr[h]->null && i < memory) {
-            if (arr[h]->key == k && !arr[h]->deleted) {
-                if (arr[h]->value->in(v)) return false;
-                arr[h]->value->add(v);
-                return true;
-            }
-            if (arr[h]->deleted && first_deleted == -1) first_deleted = h;
-            h = (h + 1) % memory;
-            ++i;
-        }
-        if (first_deleted == -1) {
-            arr[h] = new Node(k, v, false);
-            ++general_size;
-        } else {
-            arr[first_deleted]->key = k;
-            arr[first_deleted]->deleted = false;
-        }
-        ++active_size;
-        return true;
+    if (argc > 1 && string{argv[1]} == "--bench-snapshot") {
+        benchmark_snapshot(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
     }
-
-    bool remove(const K &key) {
-        int h = hash<K>{}(key) % memory;
-        int i = 0;
-        while (!arr[h]->null && i < memory) {
-            if (arr[h]->key == key && !arr[h]->deleted) {
-                arr[h]->deleted = true;
-                --active_size;
-                return true;
-            }
-            h = (h + 1) % memory;
-            ++i;
+    if (argc > 2 && string{argv[1]} == "--load") {  // Prints the values of the keys after the path from a snapshot
+        MappedMultiHashMap<int, string> mapped;
+        if (!mapped.open(argv[2])) {
+            cout << "cannot open snapshot " << argv[2] << endl;
+            return 1;
         }
-        return false;
-    }
-
-    Vector<V> operator[](const K &key) {
-        int h = hash<K>{}(key) % memory;
-        int i = 0;
-        while (!arr[h]->null && i < memory) {
-            if (arr[h]->key == key && !arr[h]->deleted)
-                return arr[h]->value;
-            h = (h + 1) % memory;
-            ++i;
+        for (int a = 3; a < argc; ++a) {
+            MappedValues<string> values = mapped[atoi(argv[a])];
+            cout << argv[a] << " | [";
+            for (int i = 0; i < values.getSize(); ++i)
+                cout << values[i] << (i + 1 < values.getSize() ? " " : "");
+            cout << "]" << endl;
         }
-        return nullptr;
+        return 0;
     }
-
-    void print() {
-        for (const Node &it: *this) {
-            cout << it.key << " | ";
-            it.value->print(' ');
-            cout << (it.deleted ? "(deleted)" : "") << endl;
-        }
-    }
-
-    [[nodiscard]] int getSize() const { return active_size; }
-
-    [[nodiscard]] int getUnique() const {
-        Vector<V> v;
-        for (int i = 0; i < memory; ++i) {
-            if (!arr[i]->null && !arr[i]->deleted) {
-                for (int q = 0; q < arr[i]->value->getSize(); ++q) {
-                    bool found = false;
-                    for (int j = 0; j < v.getSize(); ++j) {
-                        if (v[j] == (*arr[i]->value)[q]) {
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (!found)
-                        v.add((*arr[i]->value)[q]);
-                }
-            }
-        }
-        return v.getSize();
-    }
-
-    MyIterator<Node> begin() {
-        for (int i = 0; i < memory; ++i)
-            if (!arr[i]->null && !arr[i]->deleted)
-                return MyIterator<Node>(&arr[i]);
-        return end();
-    }
-
-    MyIterator<Node> end() { return MyIterator<Node>(&arr[memory]); }
-
-    [[nodiscard]] MyIterator<const Node> begin() const {
-        for (int i = 0; i < memory; ++i)
-            if (!arr[i]->null && !arr[i]->deleted)
-                return MyIterator<const Node>(arr);
-        return end();
-    }
-
-    [[nodiscard]] MyIterator<const Node> end() const { return MyIterator<const Node>(&arr[memory]); }
-};
-
-
-int main() {
     MultiHashMap<int, string> hashMap;
     hashMap.add(10, "1");
     hashMap.add(2, "2");
@@ -298,5 +109,9 @@ int main() {
     hashMap.add(2, "5");
     hashMap.add(2, "6");
     hashMap.print();
+    if (argc > 2 && string{argv[1]} == "--save" && !hashMap.save(argv[2])) {
+        cout << "cannot write snapshot " << argv[2] << endl;
+        return 1;
+    }
     return 0;
 }
@@ -6,274 +6,375 @@
  * --Additional task 1
  */
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HashMap.h"
+#include "Heap.h"
 
 using namespace std;
 
-template<typename T>
-class Vector {
-    static const int default_size = 8;
 
-    int size;
-    int memory;
-    T *arr;
-
-    void resize() {
-        int past_memory = memory;
-        memory *= 2;
-        size = 0;
-        T *arr2 = new T[memory];
-        for (int i = 0; i < memory; ++i)
-            arr2[i] = T{};
-        swap(arr, arr2);
-        for (int i = 0; i < past_memory; ++i)
-            add(arr2[i]);
-        delete[] arr2;
-    }
+class InputFile {  // The whole of fd, mapped when it is a regular file and read otherwise
+    const char *data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    string buffer;
 
 public:
-    explicit Vector(const int n = 0, T default_value = T{}) {
-        memory = default_size;
-        size = n;
-        arr = new T[memory];
-        for (int i = 0; i < memory; ++i)
-            arr[i] = default_value;
+    explicit InputFile(int fd) {
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(p);
+                size = st.st_size;
+                mapped = true;
+                return;
+            }
+        }
+        char chunk[1 << 16];
+        for (ssize_t got; (got = read(fd, chunk, sizeof(chunk))) > 0;)
+            buffer.append(chunk, got);
+        data = buffer.data();
+        size = buffer.size();
     }
 
-    ~Vector() { delete[] arr; }
+    InputFile(const InputFile &) = delete;
 
-    void add(T e) {
-        if (size + 1 >= memory) resize();
-        arr[size++] = e;
+    InputFile &operator=(const InputFile &) = delete;
+
+    ~InputFile() {
+        if (mapped) munmap(const_cast<char *>(data), size);
     }
 
-    [[nodiscard]] int getSize() const { return size; }
+    [[nodiscard]] string_view text() const { return {data, size}; }
+};
 
-    T &operator[](int i) {
-        return arr[i % size];
-    }
 
-    void print() const {
-        for (int i = 0; i + 1 < size; ++i)
-            cout << arr[i] << ' ';
-        if (size > 0) cout << arr[size - 1] << endl;
-    }
+struct Command {
+    bool remove;
+    string_view key;
+    string_view value;
 };
 
-template<typename T>
-class MyIterator : public iterator<input_iterator_tag, T> {
-    T **p;
+class CommandReader {  // Tokens of "K V n" and then "A key value" or "R key" as views into the text
+    string_view text;
+    size_t pos = 0;
 
 public:
-    explicit MyIterator(T **p) : p(p) {}
+    explicit CommandReader(string_view text) : text(text) {}
 
-    MyIterator(const MyIterator &it) : p(it.p) {}
+    string_view token() {  // Empty at the end
+        while (pos < text.size() && isspace((unsigned char) text[pos])) ++pos;
+        size_t start = pos;
+        while (pos < text.size() && !isspace((unsigned char) text[pos])) ++pos;
+        return text.substr(start, pos - start);
+    }
 
-    bool operator!=(MyIterator const &other) const { return p != other.p; }
+    bool next(Command &c) {
+        string_view act = token();
+        c.remove = act == "R";
+        c.key = token();
+        if (!c.remove) c.value = token();
+        return !c.key.empty();
+    }
+};
 
-    bool operator==(MyIterator const &other) const { return p == other.p; }
 
-    typename MyIterator::reference operator*() const { return **p; }
+void benchmark() {  // ops/s and heap bytes per entry against std::unordered_map
+    const int n = 1000000;
+    vector<string> keys;
+    for (int i = 0; i < n; ++i)
+        keys.push_back("key" + to_string(i * 7919LL));
+    vector<string> missing;
+    for (int i = 0; i < n; ++i)
+        missing.push_back("key" + to_string(i * 7919LL + 1));
+    auto run = [&](const char *name, auto &map, auto add, auto contains, auto remove, size_t heap_before) {
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i)
+            add(map, keys[i], keys[(i * 31) % n]);
+        double add_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        size_t heap = heap_in_use() - heap_before;
+        start = chrono::steady_clock::now();
+        size_t found = 0;
+        for (int i = 0; i < n; ++i)
+            found += contains(map, keys[(i * 17) % n]);
+        double hit_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i)
+            found += contains(map, missing[i]);
+        double miss_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {  // Every key is replaced
+            remove(map, keys[i]);
+            add(map, missing[i], keys[i]);
+        }
+        double churn_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << name << ": add " << n / add_s / 1e6 << " Mops/s, hit " << n / hit_s / 1e6 << " Mops/s, miss "
+             << n / miss_s / 1e6 << " Mops/s, remove+add " << n / churn_s / 1e6 << " Mops/s, "
+             << double(heap) / n << " bytes/entry"
+             << (found == size_t(n) ? "" : " (lookups failed)") << endl;
+    };
+    {
+        size_t heap_before = heap_in_use();
+        HashMap<string, string> map;
+        run("HashMap", map, [](auto &m, const string &k, const string &v) { m.add(k, v); },
+            [](auto &m, const string &k) { return m.contains(k); }, [](auto &m, const string &k) { m.remove(k); },
+            heap_before);
+        Vector<int> histogram = map.probeHistogram();
+        cout << "HashMap probe distances:";
+        for (int d = 0; d < histogram.getSize(); ++d)
+            if (d < 8 || d + 1 == histogram.getSize())
+                cout << ' ' << d << ": " << 100.0 * histogram[d] / map.getSize() << '%';
+        cout << endl;
+    }
+    {
+        size_t heap_before = heap_in_use();
+        unordered_map<string, string> map;
+        run("std::unordered_map", map, [](auto &m, const string &k, const string &v) { m[k] = v; },
+            [](auto &m, const string &k) { return m.count(k) > 0; }, [](auto &m, const string &k) { m.erase(k); },
+            heap_before);
+    }
+}
 
-    MyIterator &operator++() {
-        while ((*(++p))->null);
-        return *this;
+void benchmark_long_keys(int n) {  // 64-character keys looked up as views into one buffer, like a parser would
+    const int length = 64;
+    string text;
+    for (int i = 0; i < n; ++i) {
+        string key = "key" + to_string(i * 7919LL);
+        text += key + string(length - key.size(), '.');
     }
-};
+    auto key = [&](int i) { return string_view(text).substr(size_t(i) * length, length); };
+    HashMap<string, string, false> map;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+        map.add(key(i), "value");
+    double add_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (int i = 0; i < n; ++i)
+        found += map.find(key((i * 17) % n)) != nullptr;
+    double find_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "add " << n / add_s / 1e6 << " Mops/s, find " << n / find_s / 1e6 << " Mops/s"
+         << (found == size_t(n) ? "" : " (lookups failed)") << endl;
+}
 
+void benchmark_vector(int n) {  // Pushes n strings, counting copies and moves of the elements
+    static long long copies, moves;
+    struct Counted {
+        string s;
 
-template<typename K, typename V>
-class HashMap {
-    static const int default_size = 8;
-    constexpr static const double rehash_size = 0.3;
+        explicit Counted(string s) : s(std::move(s)) {}
 
-    struct Node {
-        K key;
-        V value;
-        bool deleted;
-        bool null;
+        Counted(const Counted &other) : s(other.s) { ++copies; }
 
-        explicit Node(const K &k = K{}, const V &v = V{}, const bool &n = true) :
-                key(k), value(v), deleted(false), null(n) {}
+        Counted(Counted &&other) noexcept: s(std::move(other.s)) { ++moves; }
     };
-
-    Node **arr;
-    int active_size;  // Size without deleted
-    int memory;
-    int general_size;  // Size with deleted
-
-    void resize() {
-        int past_memory = memory;
-        memory *= 2;
-        general_size = 0;
-        active_size = 0;
-        Node **arr2 = new Node *[memory + 1];
-        for (int i = 0; i < memory + 1; ++i)
-            arr2[i] = new Node;
-        arr2[memory]->null = false;
-        swap(arr, arr2);
-        for (int i = 0; i < past_memory; ++i) {
-            if (!arr2[i]->null && !arr2[i]->deleted)
-                add(arr2[i]->key, arr2[i]->value);
-        }
-        for (int i = 0; i < past_memory + 1; ++i)
-            if (arr2[i])
-                delete arr2[i];
-        delete[] arr2;
+    auto start = chrono::steady_clock::now();
+    {
+        Vector<Counted> v;
+        for (int i = 0; i < n; ++i)
+            v.emplace_back("value" + to_string(i));
     }
-
-    void rehash() {
-        general_size = 0;
-        active_size = 0;
-        Node **arr2 = new Node *[memory + 1];
-        for (int i = 0; i < memory + 1; ++i)
-            arr2[i] = new Node;
-        arr2[memory]->null = false;
-        swap(arr, arr2);
-        for (int i = 0; i < memory; ++i) {
-            if (!arr2[i]->null && !arr2[i]->deleted)
-                add(arr2[i]->key, arr2[i]->value);
-        }
-        for (int i = 0; i < memory + 1; ++i)
-            if (arr2[i])
-                delete arr2[i];
-        delete[] arr2;
+    double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Vector: " << n / s / 1e6 << " M pushes/s, " << copies << " copies, " << double(moves) / n
+         << " moves per element" << endl;
+    copies = moves = 0;
+    start = chrono::steady_clock::now();
+    {
+        vector<Counted> v;
+        for (int i = 0; i < n; ++i)
+            v.emplace_back("value" + to_string(i));
     }
+    s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "std::vector: " << n / s / 1e6 << " M pushes/s, " << copies << " copies, " << double(moves) / n
+         << " moves per element" << endl;
+}
 
-public:
-    HashMap() {
-        memory = default_size;
-        active_size = 0;
-        general_size = 0;
-        arr = new Node *[memory + 1];
-        for (int i = 0; i < memory + 1; ++i)
-            arr[i] = new Node;
-        arr[memory]->null = false;
+void benchmark_latency(int n) {  // p99 and worst add latency for every 10% of growth
+    const int window = max(n / 10, 1);
+    HashMap<string, string> map;
+    vector<long long> ns(window);
+    for (int i = 0; i < n; ++i) {
+        string key = "key" + to_string(i * 7919LL);
+        auto start = chrono::steady_clock::now();
+        map.add(key, key);
+        ns[i % window] = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        if ((i + 1) % window == 0) {
+            sort(ns.begin(), ns.end());
+            cout << "size " << i + 1 << ": p99 " << ns[window * 99 / 100] / 1e3 << " us, max "
+                 << ns[window - 1] / 1e3 << " us" << endl;
+        }
     }
+}
 
-    ~HashMap() {
-        for (int i = 0; i < memory + 1; ++i)
-            if (arr[i])
-                delete arr[i];
-        delete[] arr;
+void benchmark_unique(int n) {  // Exact count against the HyperLogLog estimate
+    HashMap<string, string> exact;
+    HashMap<string, string, false> approx;
+    for (int i = 0; i < n; ++i) {
+        string key = "key" + to_string(i * 7919LL), value = "value" + to_string(i % (n / 3 + 1));
+        exact.add(key, value);
+        approx.add(key, value);
     }
+    auto start = chrono::steady_clock::now();
+    int e = exact.getUnique();
+    double exact_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    int a = approx.getUnique();
+    double approx_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    cout << "exact: " << e << " in " << exact_us << " us, " << exact.bytes() - approx.bytes() << " index bytes" << endl;
+    cout << "HyperLogLog: " << a << " in " << approx_us << " us, error " << 100.0 * (a - e) / e << "%, "
+         << sizeof(HyperLogLog) << " bytes" << endl;
+}
 
-    bool add(const K &key, const V &value) {
-        if (active_size + 1 > int(rehash_size * memory)) resize();
-        else if (general_size > 2 * active_size) rehash();
-        int h = hash<K>{}(key) % memory;
-        int i = 0;
-        int first_deleted = -1;
-        while (!arr[h]->null && i < memory) {
-            if (arr[h]->key == key && !arr[h]->deleted) {
-                if (arr[h]->value == value) return false;
-                arr[h]->value = value;
-                return true;
-            }
-            if (arr[h]->deleted && first_deleted == -1) first_deleted = h;
-            h = (h + 1) % memory;
-            ++i;
-        }
-        if (first_deleted == -1) {
-            arr[h] = new Node(key, value, false);
-            ++general_size;
-        } else {
-            arr[first_deleted]->key = key;
-            arr[first_deleted]->deleted = false;
+void benchmark_concurrent(int max_threads) {  // Mixed load of 80% lookups, 10% adds and 10% removes
+    const int n = 1000000, keys = 1 << 18;
+    vector<string> names;
+    for (int i = 0; i < keys; ++i)
+        names.push_back("key" + to_string(i * 7919LL));
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        ConcurrentHashMap<string, string> map;
+        for (int i = 0; i < keys; i += 2)
+            map.add(names[i], names[i]);
+        auto start = chrono::steady_clock::now();
+        vector<thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back([&, t] {
+                unsigned x = 2654435761u * (t + 1);
+                for (int i = 0; i < n; ++i) {
+                    x ^= x << 13;
+                    x ^= x >> 17;
+                    x ^= x << 5;
+                    const string &key = names[x % keys];
+                    if (x >> 28 < 13) (void) map.contains(key);
+                    else if (x >> 28 < 15) map.add(key, key);
+                    else map.remove(key);
+                }
+            });
         }
-        ++active_size;
-        return true;
+        for (thread &t: pool)
+            t.join();
+        double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << threads << " threads: " << double(n) * threads / s / 1e6 << " Mops/s, size " << map.getSize() << endl;
     }
+}
 
-    bool remove(const K &key) {
-        int h = hash<K>{}(key) % memory;
-        int i = 0;
-        while (!arr[h]->null && i < memory) {
-            if (arr[h]->key == key && !arr[h]->deleted) {
-                arr[h]->deleted = true;
-                --active_size;
-                return true;
+void benchmark_snapshot(int n) {  // Starting from a snapshot against replaying the adds, for growing sizes
+    const string path = "/tmp/hashmap_benchmark.snapshot";
+    for (int size = n / 100; size <= n; size *= 10) {
+        auto start = chrono::steady_clock::now();
+        double save_s;
+        {
+            HashMap<string, string> map;
+            for (int i = 0; i < size; ++i)
+                map.add("key" + to_string(i * 7919LL), "value" + to_string(i));
+            double build_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            start = chrono::steady_clock::now();
+            if (!map.save(path)) {
+                cout << "cannot write " << path << endl;
+                return;
             }
-            h = (h + 1) % memory;
-            ++i;
+            save_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << size << " keys: replay " << build_s * 1e3 << " ms, save " << save_s * 1e3 << " ms";
         }
-        return false;
+        start = chrono::steady_clock::now();
+        MappedHashMap<string, string> mapped;
+        bool opened = mapped.open(path);
+        string_view first = mapped["key0"];
+        double open_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        size_t found = 0;
+        for (int i = 0; i < size; ++i)
+            found += mapped.contains("key" + to_string((i * 17LL) % size * 7919));
+        double find_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << ", open and first lookup " << open_s * 1e6 << " us, lookups " << size / find_s / 1e6 << " Mops/s"
+             << (opened && first == "value0" && found == size_t(size) ? "" : " (lookups failed)") << endl;
     }
+    remove(path.c_str());
+}
 
-    V operator[](const K &key) {
-        int h = hash<K>{}(key) % memory;
-        int i = 0;
-        while (!arr[h]->null && i < memory) {
-            if (arr[h]->key == key && !arr[h]->deleted)
-                return arr[h]->value;
-            h = (h + 1) % memory;
-            ++i;
-        }
-        return nullptr;
-    }
 
-    void print() {
-        for (const Node &it: *this) {
-            cout << it.key << ' ' << it.value << ' ' << (it.deleted ? "(deleted)" : "") << endl;
-        }
+int main(int argc, char *argv[]) {
+    if (argc > 1 && string{argv[1]} == "--bench") {
+        benchmark();
+        return 0;
     }
-
-    [[nodiscard]] int getSize() const { return active_size; }
-
-    [[nodiscard]] int getUnique() const {
-        Vector<V> v;
-        for (int i = 0; i < memory; ++i) {
-            if (!arr[i]->null && !arr[i]->deleted) {
-                bool found = false;
-                for (int j = 0; j < v.getSize(); ++j) {
-                    if (v[j] == arr[i]->value) {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found)
-                    v.add(arr[i]->value);
-            }
-        }
-        return v.getSize();
+    if (argc > 1 && string{argv[1]} == "--bench-unique") {
+        benchmark_unique(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
     }
-
-    MyIterator<Node> begin() {
-        for (int i = 0; i < memory; ++i)
-            if (!arr[i]->null && !arr[i]->deleted)
-                return MyIterator<Node>(&arr[i]);
-        return end();
+    if (argc > 1 && string{argv[1]} == "--bench-concurrent") {
+        benchmark_concurrent(argc > 2 ? atoi(argv[2]) : int(max(thread::hardware_concurrency(), 1u)));
+        return 0;
     }
-
-    MyIterator<Node> end() { return MyIterator<Node>(&arr[memory]); }
-
-    [[nodiscard]] MyIterator<const Node> begin() const {
-        for (int i = 0; i < memory; ++i)
-            if (!arr[i]->null && !arr[i]->deleted)
-                return MyIterator<const Node>(arr);
-        return end();
+    if (argc > 1 && string{argv[1]} == "--bench-long-keys") {
+        benchmark_long_keys(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
     }
-
-    [[nodiscard]] MyIterator<const Node> end() const { return MyIterator<const Node>(&arr[memory]); }
-};
-
-
-int main() {
-    char K, V;
-    cin >> K >> V;
+    if (argc > 1 && string{argv[1]} == "--bench-vector") {
+        benchmark_vector(argc > 2 ? atoi(argv[2]) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--bench-latency") {
+        benchmark_latency(argc > 2 ? atoi(argv[2]) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && string{argv[1]} == "--bench-snapshot") {
+        benchmark_snapshot(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 2 && string{argv[1]} == "--load") {  // Prints the value of every key on stdin from a snapshot
+        MappedHashMap<string, string> mapped;
+        if (!mapped.open(argv[2])) {
+            cout << "cannot open snapshot " << argv[2] << endl;
+            return 1;
+        }
+        InputFile input(STDIN_FILENO);
+        CommandReader reader(input.text());
+        for (string_view key = reader.token(); !key.empty(); key = reader.token())
+            cout << mapped[key] << endl;
+        return 0;
+    }
+    InputFile input(STDIN_FILENO);
+    CommandReader reader(input.text());
+    reader.token();  // Types of keys and values, always strings here
+    reader.token();
+    string_view count = reader.token();
+    int n = 0;
+    from_chars(count.data(), count.data() + count.size(), n);
     HashMap<string, string> hashMap;
-    int n;
-    cin >> n;
-    string act, k, v;
-    for (int i = 0; i < n; ++i) {
-        cin >> act >> k;
-        if (act == "R") hashMap.remove(k);
-        else {
-            cin >> v;
-            hashMap.add(k, v);
+    const int batch_size = 256;
+    Command batch[batch_size];
+    int size = 0;
+    for (int i = 0; i < n && reader.next(batch[size]); ++i) {
+        if (++size == batch_size) {
+            hashMap.apply(batch, size);
+            size = 0;
         }
     }
+    hashMap.apply(batch, size);
     cout << hashMap.getSize() << ' ' << hashMap.getUnique() << endl;
+    if (argc > 2 && string{argv[1]} == "--save" && !hashMap.save(argv[2])) {  // Run the commands, then snapshot
+        cout << "cannot write snapshot " << argv[2] << endl;
+        return 1;
+    }
     // hashMap.print();
     return 0;
 }
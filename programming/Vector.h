@@ -0,0 +1,127 @@
+/*
+ * Vector of Task3.1.2.cpp and Task3.1.2(additional).cpp
+ */
+
+#pragma once
+
+#include <cassert>
+#include <iostream>
+#include <new>
+#include <utility>
+
+using namespace std;
+
+template<typename T>
+class Vector {
+    static const int default_size = 8;
+
+    int size;
+    int memory;
+    T *arr;  // Raw storage, only the first size elements are constructed
+
+    void reallocate(int n) {  // Moves the elements into storage for n
+        T *arr2 = static_cast<T *>(::operator new(sizeof(T) * n));
+        for (int i = 0; i < size; ++i) {
+            new(&arr2[i]) T(std::move(arr[i]));
+            arr[i].~T();
+        }
+        ::operator delete(arr);
+        arr = arr2;
+        memory = n;
+    }
+
+public:
+    Vector() : size(0), memory(0), arr(nullptr) {}  // Allocates on the first add
+
+    explicit Vector(const int n, const T &default_value = T{}) : Vector() {
+        reserve(n);
+        for (int i = 0; i < n; ++i)
+            new(&arr[size++]) T(default_value);
+    }
+
+    Vector(const Vector &other) : Vector() {
+        reserve(other.size);
+        for (int i = 0; i < other.size; ++i)
+            new(&arr[size++]) T(other.arr[i]);
+    }
+
+    Vector(Vector &&other) noexcept : size(other.size), memory(other.memory), arr(other.arr) {
+        other.size = other.memory = 0;
+        other.arr = nullptr;
+    }
+
+    Vector &operator=(Vector other) {  // Copied or moved into other first
+        swap(size, other.size);
+        swap(memory, other.memory);
+        swap(arr, other.arr);
+        return *this;
+    }
+
+    ~Vector() {
+        for (int i = 0; i < size; ++i)
+            arr[i].~T();
+        ::operator delete(arr);
+    }
+
+    void reserve(int n) {
+        if (n > memory) reallocate(n);
+    }
+
+    template<typename... Args>
+    T &emplace_back(Args &&... args) {
+        if (size == memory) {
+            int n = memory ? 2 * memory : default_size;
+            T *arr2 = static_cast<T *>(::operator new(sizeof(T) * n));
+            new(&arr2[size]) T(std::forward<Args>(args)...);  // Before the move, args may be one of the elements
+            for (int i = 0; i < size; ++i) {
+                new(&arr2[i]) T(std::move(arr[i]));
+                arr[i].~T();
+            }
+            ::operator delete(arr);
+            arr = arr2;
+            memory = n;
+        } else {
+            new(&arr[size]) T(std::forward<Args>(args)...);
+        }
+        return arr[size++];
+    }
+
+    void add(const T &e) { emplace_back(e); }
+
+    void add(T &&e) { emplace_back(std::move(e)); }
+
+    [[nodiscard]] int getSize() const { return size; }
+
+    T &operator[](int i) {
+        assert(0 <= i && i < size);
+        return arr[i];
+    }
+
+    const T &operator[](int i) const {
+        assert(0 <= i && i < size);
+        return arr[i];
+    }
+
+    bool operator==(const Vector &other) const {
+        if (size == other.size) {
+            for (int i = 0; i < size; ++i) {
+                if (arr[i] != other.arr[i]) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void print(char end='\n') const {
+        cout << '[';
+        for (int i = 0; i + 1 < size; ++i)
+            cout << arr[i] << ' ';
+        if (size > 0) cout << arr[size - 1] << "]" << end;
+    }
+
+    [[nodiscard]] bool in(const T &e) const {
+        for (int i = 0; i < size; ++i)
+            if (arr[i] == e) return true;
+        return false;
+    }
+};
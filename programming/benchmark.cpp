@@ -0,0 +1,396 @@
+/*
+ * version 1.0
+ * Benchmarks of HashMap, MultiHashMap and Vector against the standard containers
+ * benchmark [--json] [max size]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "HashMap.h"
+#include "Heap.h"
+#include "MultiHashMap.h"
+
+using namespace std;
+
+
+long long allocations = 0;  // Calls of operator new, every container allocates through it
+
+void *operator new(size_t n) {
+    ++allocations;
+    if (void *p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+
+// Not inlined, or GCC sees free() on memory from operator new and warns
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+
+
+struct Result {
+    string container, key, workload;
+    int size;
+    double ops;  // Per second
+    long long allocations;
+    double bytes = NAN;  // Heap per entry, measured by insert
+    double probe_avg = NAN, probe_max = NAN;  // Slots or bucket entries passed before a key, measured after insert
+};
+
+vector<Result> results;
+long long sink;  // Keeps the lookups from being optimized out
+
+struct Probes {
+    double avg, max;
+};
+
+template<typename T>
+long long weight(const T &x) {  // Something of every element read, so that iterating is not optimized out
+    if constexpr (is_same_v<T, string>) return (long long) x.size();
+    else return x;
+}
+
+template<typename T>
+T make(long long x) {  // Distinct x give distinct keys
+    if constexpr (is_same_v<T, string>) return "key" + to_string(x);
+    else return T(x);
+}
+
+template<typename F>
+Result &measure(const string &container, const string &key, const string &workload, int size, long long ops, F f) {
+    long long allocations_before = allocations;
+    auto start = chrono::steady_clock::now();
+    f();
+    double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    long long allocated = allocations - allocations_before;  // Before the strings of the result are copied
+    results.push_back({container, key, workload, size, ops / s, allocated});
+    return results.back();  // Valid until the next measurement
+}
+
+template<typename F>
+void measure_repeated(const string &container, const string &key, const string &workload, int size, long long per_call,
+                      F f) {  // Calls f for 50 ms at least, for operations too fast or too slow to run a fixed number
+    long long allocations_before = allocations, calls = 0;
+    auto start = chrono::steady_clock::now();
+    double s = 0;
+    for (long long batch = 1; s < 0.05; batch *= 2) {  // The clock is read once a batch, it costs more than some calls
+        for (long long i = 0; i < batch; ++i) {
+            f();
+            asm volatile("" : : : "memory");  // The calls read the container again, they are not folded into one
+        }
+        calls += batch;
+        s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    long long allocated = (allocations - allocations_before) / calls;
+    results.push_back({container, key, workload, size, calls * per_call / s, allocated});
+}
+
+template<typename Histogram>
+Probes probes_of(const Histogram &histogram) {
+    double sum = 0, count = 0, max = 0;
+    for (int d = 0; d < histogram.getSize(); ++d) {
+        sum += double(d) * histogram[d];
+        count += histogram[d];
+        if (histogram[d]) max = d;
+    }
+    return {count ? sum / count : 0, max};
+}
+
+template<typename Map>
+Probes bucket_probes(const Map &map) {  // The entries before each one in its bucket
+    double sum = 0, max = 0;
+    for (size_t b = 0; b < map.bucket_count(); ++b) {
+        double s = map.bucket_size(b);
+        sum += s * (s - 1) / 2;
+        if (s) max = std::max(max, s - 1);
+    }
+    return {map.empty() ? 0 : sum / double(map.size()), max};
+}
+
+
+// The same calls on every map, so that the workloads below are written once
+template<typename K, typename V>
+void add(HashMap<K, V> &m, const K &k, const V &v) { m.add(k, v); }
+
+template<typename K, typename V>
+void add(unordered_map<K, V> &m, const K &k, const V &v) { m[k] = v; }
+
+template<typename K, typename V>
+bool contains(const HashMap<K, V> &m, const K &k) { return m.contains(k); }
+
+template<typename K, typename V>
+bool contains(const unordered_map<K, V> &m, const K &k) { return m.count(k) > 0; }
+
+template<typename K, typename V>
+void remove(HashMap<K, V> &m, const K &k) { m.remove(k); }
+
+template<typename K, typename V>
+void remove(unordered_map<K, V> &m, const K &k) { m.erase(k); }
+
+template<typename K, typename V>
+long long iterate(const HashMap<K, V> &m) {
+    long long n = 0;
+    for (const auto &node: m)
+        n += weight(node.value);
+    return n;
+}
+
+template<typename K, typename V>
+long long iterate(const unordered_map<K, V> &m) {
+    long long n = 0;
+    for (const auto &entry: m)
+        n += weight(entry.second);
+    return n;
+}
+
+template<typename K, typename V>
+int unique(const HashMap<K, V> &m) { return m.getUnique(); }
+
+template<typename K, typename V>
+int unique(const unordered_map<K, V> &m) {  // Without an index every call has to collect the values
+    unordered_set<V> values;
+    for (const auto &entry: m)
+        values.insert(entry.second);
+    return int(values.size());
+}
+
+template<typename K, typename V>
+Probes probes(const HashMap<K, V> &m) { return probes_of(m.probeHistogram()); }
+
+template<typename K, typename V>
+Probes probes(const unordered_map<K, V> &m) { return bucket_probes(m); }
+
+
+template<typename K, typename V>
+void add(MultiHashMap<K, V> &m, const K &k, const V &v) { m.add(k, v); }
+
+template<typename K, typename V>
+void add(unordered_multimap<K, V> &m, const K &k, const V &v) { m.emplace(k, v); }
+
+template<typename K, typename V>
+int values_of(const MultiHashMap<K, V> &m, const K &k) { return m[k].getSize(); }
+
+template<typename K, typename V>
+int values_of(const unordered_multimap<K, V> &m, const K &k) {
+    auto range = m.equal_range(k);
+    return int(distance(range.first, range.second));
+}
+
+template<typename K, typename V>
+void remove(MultiHashMap<K, V> &m, const K &k) { m.remove(k); }
+
+template<typename K, typename V>
+void remove(unordered_multimap<K, V> &m, const K &k) { m.erase(k); }
+
+template<typename K, typename V>
+long long iterate(const MultiHashMap<K, V> &m) {
+    long long n = 0;
+    for (const auto &node: m)
+        n += weight(node.key) + node.size;
+    return n;
+}
+
+template<typename K, typename V>
+long long iterate(const unordered_multimap<K, V> &m) {
+    long long n = 0;
+    for (const auto &entry: m)
+        n += weight(entry.second);
+    return n;
+}
+
+template<typename K, typename V>
+int unique(const MultiHashMap<K, V> &m) { return m.getUnique(); }
+
+template<typename K, typename V>
+int unique(const unordered_multimap<K, V> &m) {
+    unordered_set<V> values;
+    for (const auto &entry: m)
+        values.insert(entry.second);
+    return int(values.size());
+}
+
+template<typename K, typename V>
+Probes probes(const MultiHashMap<K, V> &m) { return probes_of(m.probeHistogram()); }
+
+template<typename K, typename V>
+Probes probes(const unordered_multimap<K, V> &m) { return bucket_probes(m); }
+
+
+template<typename Map, typename K>
+void benchmark_map(const string &container, const string &key, int n) {
+    vector<K> keys, missing;
+    for (int i = 0; i < n; ++i) {
+        keys.push_back(make<K>(i * 7919LL));
+        missing.push_back(make<K>(i * 7919LL + 1));
+    }
+    size_t heap_before = heap_in_use();
+    Map map;
+    Result &insert = measure(container, key, "insert", n, n, [&] {
+        for (int i = 0; i < n; ++i)
+            add(map, keys[i], keys[i % (n / 3 + 1)]);
+    });
+    insert.bytes = double(heap_in_use() - heap_before) / n;
+    Probes p = probes(map);
+    insert.probe_avg = p.avg;
+    insert.probe_max = p.max;
+    measure(container, key, "hit", n, n, [&] {
+        for (int i = 0; i < n; ++i)
+            sink += contains(map, keys[(i * 17LL) % n]);
+    });
+    measure(container, key, "miss", n, n, [&] {
+        for (int i = 0; i < n; ++i)
+            sink += contains(map, missing[i]);
+    });
+    measure_repeated(container, key, "iterate", n, n, [&] { sink += iterate(map); });
+    measure_repeated(container, key, "getUnique", n, 1, [&] { sink += unique(map); });
+    measure(container, key, "mixed", n, n, [&] {  // 50% lookups, 25% adds, 25% removes over the keys and the missing
+        unsigned x = 2463534242u;
+        for (int i = 0; i < n; ++i) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            const K &k = x & 4 ? keys[x % n] : missing[x % n];
+            if ((x & 3) < 2) sink += contains(map, k);
+            else if ((x & 3) == 2) add(map, k, k);
+            else remove(map, k);
+        }
+    });
+    measure(container, key, "delete", n, 2LL * n, [&] {
+        for (int i = 0; i < n; ++i) {
+            remove(map, keys[i]);
+            remove(map, missing[i]);
+        }
+    });
+}
+
+template<typename Map, typename K>
+void benchmark_multimap(const string &container, const string &key, int n) {  // n values on n / 4 keys
+    int keys = max(n / 4, 1);
+    vector<K> names, missing, values;
+    for (int i = 0; i < keys; ++i) {
+        names.push_back(make<K>(i * 7919LL));
+        missing.push_back(make<K>(i * 7919LL + 1));
+    }
+    for (int i = 0; i < n; ++i)
+        values.push_back(make<K>(i % (n / 3 + 1) + 1000000000LL * (i % 4)));  // The four values of a key differ
+    size_t heap_before = heap_in_use();
+    Map map;
+    Result &insert = measure(container, key, "insert", n, n, [&] {
+        for (int i = 0; i < n; ++i)
+            add(map, names[i % keys], values[i]);
+    });
+    insert.bytes = double(heap_in_use() - heap_before) / n;
+    Probes p = probes(map);
+    insert.probe_avg = p.avg;
+    insert.probe_max = p.max;
+    measure(container, key, "hit", n, keys, [&] {
+        for (int i = 0; i < keys; ++i)
+            sink += values_of(map, names[(i * 17LL) % keys]);
+    });
+    measure(container, key, "miss", n, keys, [&] {
+        for (int i = 0; i < keys; ++i)
+            sink += values_of(map, missing[i]);
+    });
+    measure_repeated(container, key, "iterate", n, n, [&] { sink += iterate(map); });
+    measure_repeated(container, key, "getUnique", n, 1, [&] { sink += unique(map); });
+    measure(container, key, "mixed", n, keys, [&] {
+        unsigned x = 2463534242u;
+        for (int i = 0; i < keys; ++i) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            const K &k = x & 4 ? names[x % keys] : missing[x % keys];
+            if ((x & 3) < 2) sink += values_of(map, k);
+            else if ((x & 3) == 2) add(map, k, values[x % n]);
+            else remove(map, k);
+        }
+    });
+    measure(container, key, "delete", n, 2LL * keys, [&] {
+        for (int i = 0; i < keys; ++i) {
+            remove(map, names[i]);
+            remove(map, missing[i]);
+        }
+    });
+}
+
+template<typename Vec, typename T>
+void benchmark_vector(const string &container, const string &key, int n) {
+    vector<T> elements;
+    for (int i = 0; i < n; ++i)
+        elements.push_back(make<T>(i));
+    size_t heap_before = heap_in_use();
+    Vec v;
+    Result &insert = measure(container, key, "insert", n, n, [&] {
+        for (int i = 0; i < n; ++i) {
+            if constexpr (is_same_v<Vec, vector<T>>) v.push_back(elements[i]);
+            else v.add(elements[i]);
+        }
+    });
+    insert.bytes = double(heap_in_use() - heap_before) / n;
+    measure_repeated(container, key, "iterate", n, n, [&] {
+        for (int i = 0; i < n; ++i)
+            sink += weight(v[i]);
+    });
+}
+
+
+void print(const Result &r) {
+    cout << r.container << ' ' << r.key << ' ' << r.size << ' ' << r.workload << ": " << r.ops / 1e6 << " Mops/s, "
+         << r.allocations << " allocations";
+    if (!isnan(r.bytes)) cout << ", " << r.bytes << " bytes/entry";
+    if (!isnan(r.probe_avg)) cout << ", probe avg " << r.probe_avg << " max " << r.probe_max;
+    cout << endl;
+}
+
+void print_json() {  // One object per result, null for what a workload does not measure
+    auto number = [](double x) { return isnan(x) ? string("null") : to_string(x); };
+    cout << "[" << endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        cout << "  {\"container\": \"" << r.container << "\", \"key\": \"" << r.key << "\", \"size\": " << r.size
+             << ", \"workload\": \"" << r.workload << "\", \"ops_per_s\": " << number(r.ops)
+             << ", \"allocations\": " << r.allocations << ", \"bytes_per_entry\": " << number(r.bytes)
+             << ", \"probe_avg\": " << number(r.probe_avg) << ", \"probe_max\": " << number(r.probe_max) << "}"
+             << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    cout << "]" << endl;
+}
+
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    int max_size = 1000000;
+    for (int a = 1; a < argc; ++a) {
+        if (string{argv[a]} == "--json") json = true;
+        else max_size = atoi(argv[a]);
+    }
+    for (int n = 1000; n <= max_size; n *= 10) {
+        size_t first = results.size();
+        benchmark_map<HashMap<int, int>, int>("HashMap", "int", n);
+        benchmark_map<unordered_map<int, int>, int>("std::unordered_map", "int", n);
+        benchmark_map<HashMap<string, string>, string>("HashMap", "string", n);
+        benchmark_map<unordered_map<string, string>, string>("std::unordered_map", "string", n);
+        benchmark_multimap<MultiHashMap<int, int>, int>("MultiHashMap", "int", n);
+        benchmark_multimap<unordered_multimap<int, int>, int>("std::unordered_multimap", "int", n);
+        benchmark_multimap<MultiHashMap<string, string>, string>("MultiHashMap", "string", n);
+        benchmark_multimap<unordered_multimap<string, string>, string>("std::unordered_multimap", "string", n);
+        benchmark_vector<Vector<int>, int>("Vector", "int", n);
+        benchmark_vector<vector<int>, int>("std::vector", "int", n);
+        benchmark_vector<Vector<string>, string>("Vector", "string", n);
+        benchmark_vector<vector<string>, string>("std::vector", "string", n);
+        if (!json)
+            for (size_t i = first; i < results.size(); ++i)
+                print(results[i]);
+    }
+    if (json) print_json();
+    return sink == 42 ? 1 : 0;  // Depends on sink, so that it is computed
+}